@@ -2,7 +2,9 @@
 #include <list.h>
 #include <string.h>
 #include <stdio.h>
+#include "devices/block_queue.h"
 #include "devices/ide.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
 
 /* A block device. */
@@ -16,9 +18,12 @@ struct block
 
     const struct block_operations *ops;  /* Driver operations. */
     void *aux;                          /* Extra data owned by driver. */
+    struct block_queue *queue;          /* Request queue, or null. */
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+    uint32_t read_hist[BLOCKSTATS_BUCKETS];  /* Reads by time taken. */
+    uint32_t write_hist[BLOCKSTATS_BUCKETS]; /* Writes by time taken. */
   };
 
 /* List of all block devices. */
@@ -113,6 +118,77 @@ check_sector (struct block *block, block_sector_t sector)
     }
 }
 
+/* Verifies that the CNT sectors starting at SECTOR are valid
+   offsets within BLOCK and, for a write, that BLOCK may be
+   written.  Panics if not. */
+static void
+check_transfer (struct block *block, bool write, block_sector_t sector,
+                size_t cnt)
+{
+  ASSERT (cnt > 0);
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  ASSERT (!write || block->type != BLOCK_FOREIGN);
+}
+
+/* Transfers CNT sectors starting at SECTOR between BLOCK_ and
+   BUFFER by calling the driver directly, using a single transfer
+   if the driver supports it. */
+static void
+transfer (void *block_, bool write, block_sector_t sector, size_t cnt,
+          void *buffer_)
+{
+  struct block *block = block_;
+  uint8_t *buffer = buffer_;
+  uint64_t start = timer_cycles ();
+  size_t i;
+
+  if (write)
+    {
+      if (cnt > 1 && block->ops->write_multiple != NULL)
+        block->ops->write_multiple (block->aux, sector, cnt, buffer);
+      else
+        for (i = 0; i < cnt; i++)
+          block->ops->write (block->aux, sector + i,
+                             buffer + i * BLOCK_SECTOR_SIZE);
+    }
+  else
+    {
+      if (cnt > 1 && block->ops->read_multiple != NULL)
+        block->ops->read_multiple (block->aux, sector, cnt, buffer);
+      else
+        for (i = 0; i < cnt; i++)
+          block->ops->read (block->aux, sector + i,
+                            buffer + i * BLOCK_SECTOR_SIZE);
+    }
+  block_stats_add_time (write ? block->write_hist : block->read_hist,
+                        timer_cycles () - start);
+}
+
+/* Transfers CNT sectors starting at SECTOR between BLOCK and
+   BUFFER and waits for the transfer to finish, going through
+   BLOCK's request queue if it has one. */
+static void
+transfer_sync (struct block *block, bool write, block_sector_t sector,
+               size_t cnt, void *buffer)
+{
+  check_transfer (block, write, sector, cnt);
+  if (block->queue != NULL)
+    {
+      struct block_request r;
+      block_request_init (&r, write, sector, cnt, buffer, NULL, NULL);
+      block_queue_submit (block->queue, &r);
+      block_wait (&r);
+    }
+  else
+    transfer (block, write, sector, cnt, buffer);
+
+  if (write)
+    block->write_cnt += cnt;
+  else
+    block->read_cnt += cnt;
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -120,9 +196,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  transfer_sync (block, false, sector, 1, buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +207,97 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  transfer_sync (block, true, sector, 1, (void *) buffer);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Uses a single transfer if the driver supports it.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector,
+                     size_t cnt, void *buffer)
+{
+  if (cnt > 0)
+    transfer_sync (block, false, sector, cnt, buffer);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving the
+   data.  Uses a single transfer if the driver supports it.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      size_t cnt, const void *buffer)
+{
+  if (cnt > 0)
+    transfer_sync (block, true, sector, cnt, (void *) buffer);
+}
+
+/* Initializes R as a request to transfer CNT sectors starting at
+   SECTOR between a block device and BUFFER, in the direction
+   given by WRITE.  If DONE is non-null, it will be called with R
+   on completion; AUX is stored in R for its use. */
+void
+block_request_init (struct block_request *r, bool write,
+                    block_sector_t sector, size_t cnt, void *buffer,
+                    void (*done) (struct block_request *), void *aux)
+{
+  r->write = write;
+  r->sector = sector;
+  r->cnt = cnt;
+  r->buffer = buffer;
+  r->deadline = 0;
+  r->queued = 0;
+  r->done = done;
+  r->aux = aux;
+  sema_init (&r->finished, 0);
+}
+
+/* Submits R to BLOCK and returns without waiting for it, if
+   BLOCK has a request queue.  Otherwise, carries R out at once.
+   Many requests in flight let the queue merge adjacent ones and
+   order them to keep seeks short. */
+void
+block_submit (struct block *block, struct block_request *r)
+{
+  check_transfer (block, r->write, r->sector, r->cnt);
+  if (r->write)
+    block->write_cnt += r->cnt;
+  else
+    block->read_cnt += r->cnt;
+
+  if (block->ops->submit != NULL)
+    block->ops->submit (block->aux, r);
+  else if (block->queue != NULL)
+    block_queue_submit (block->queue, r);
+  else
+    {
+      transfer (block, r->write, r->sector, r->cnt, r->buffer);
+      block_request_complete (r);
+    }
+}
+
+/* Reports that R has been carried out, by calling its callback
+   or waking up its waiter.  For use by block devices. */
+void
+block_request_complete (struct block_request *r)
+{
+  if (r->done != NULL)
+    r->done (r);
+  else
+    sema_up (&r->finished);
+}
+
+/* Waits for R, submitted without a callback, to complete. */
+void
+block_wait (struct block_request *r)
+{
+  ASSERT (r->done == NULL);
+  sema_down (&r->finished);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,15 +321,77 @@ block_type (struct block *block)
   return block->type;
 }
 
-/* Prints statistics for each block device used for a Pintos role. */
+/* Stores the number of sectors read from and written to BLOCK so
+   far into *READ_CNT and *WRITE_CNT. */
+void
+block_get_stats (struct block *block, uint64_t *read_cnt,
+                 uint64_t *write_cnt)
+{
+  *read_cnt = block->read_cnt;
+  *write_cnt = block->write_cnt;
+}
+
+/* Stores all of BLOCK's statistics into STATS. */
+void
+block_get_blockstats (struct block *block, struct blockstats *stats)
+{
+  memset (stats, 0, sizeof *stats);
+  stats->read_cnt = block->read_cnt;
+  stats->write_cnt = block->write_cnt;
+  stats->cycles_per_tick = timer_cycles_per_tick ();
+  memcpy (stats->read_hist, block->read_hist, sizeof stats->read_hist);
+  memcpy (stats->write_hist, block->write_hist, sizeof stats->write_hist);
+  if (block->queue != NULL)
+    block_queue_get_stats (block->queue, stats);
+}
+
+/* Counts a time of CYCLES in histogram HIST. */
+void
+block_stats_add_time (uint32_t hist[BLOCKSTATS_BUCKETS], uint64_t cycles)
+{
+  int bucket = 0;
+
+  while (cycles >= 2 && bucket < BLOCKSTATS_BUCKETS - 1)
+    {
+      cycles >>= 1;
+      bucket++;
+    }
+  hist[bucket]++;
+}
+
+/* Prints histogram HIST, labeled NAME, if it is not empty, as
+   "BUCKET:COUNT" pairs. */
+static void
+print_hist (const char *name, const uint32_t hist[BLOCKSTATS_BUCKETS])
+{
+  bool empty = true;
+  int i;
+
+  for (i = 0; i < BLOCKSTATS_BUCKETS; i++)
+    if (hist[i] != 0)
+      {
+        if (empty)
+          printf ("  %s (log2 cycles):", name);
+        printf (" %d:%"PRIu32, i, hist[i]);
+        empty = false;
+      }
+  if (!empty)
+    printf ("\n");
+}
+
+/* Prints statistics for each block device used for a Pintos role,
+   and the time histograms of every device that has been used,
+   which show whether the disks are a bottleneck.  Only devices
+   with a request queue have a queue wait to show. */
 void
 block_print_stats (void)
 {
+  struct block *block;
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
     {
-      struct block *block = block_by_role[i];
+      block = block_by_role[i];
       if (block != NULL)
         {
           printf ("%s (%s): %llu reads, %llu writes\n",
@@ -176,6 +399,27 @@ block_print_stats (void)
                   block->read_cnt, block->write_cnt);
         }
     }
+
+  for (block = block_first (); block != NULL; block = block_next (block))
+    {
+      struct blockstats stats;
+
+      block_get_blockstats (block, &stats);
+      if (stats.read_cnt == 0 && stats.write_cnt == 0)
+        continue;
+      if (block->queue != NULL)
+        printf ("%s: %"PRIu64" cycles per tick, "
+                "%"PRIu64" cycles queued, at most %"PRIu32" waiting\n",
+                block->name, stats.cycles_per_tick, stats.wait_cycles,
+                stats.max_waiters);
+      else
+        printf ("%s: %"PRIu64" cycles per tick\n",
+                block->name, stats.cycles_per_tick);
+      print_hist ("read time", stats.read_hist);
+      print_hist ("write time", stats.write_hist);
+      if (block->queue != NULL)
+        print_hist ("queue wait", stats.wait_hist);
+    }
 }
 
 /* Registers a new block device with the given NAME.  If
@@ -198,8 +442,11 @@ block_register (const char *name, enum block_type type,
   block->size = size;
   block->ops = ops;
   block->aux = aux;
+  block->queue = NULL;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  memset (block->read_hist, 0, sizeof block->read_hist);
+  memset (block->write_hist, 0, sizeof block->write_hist);
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -211,6 +458,18 @@ block_register (const char *name, enum block_type type,
   return block;
 }
 
+/* Makes requests to BLOCK go through a request queue served by a
+   kernel thread, instead of calling the driver directly.  Worth
+   it for devices where the order of requests matters, such as
+   disks.  Requests to partitions of BLOCK go through the queue
+   too, since partitions forward them to BLOCK. */
+void
+block_enable_queue (struct block *block)
+{
+  ASSERT (block->queue == NULL);
+  block->queue = block_queue_create (block->name, transfer, block);
+}
+
 /* Returns the block device corresponding to LIST_ELEM, or a null
    pointer if LIST_ELEM is the list end of all_blocks. */
 static struct block *
@@ -220,4 +479,3 @@ list_elem_to_block (struct list_elem *list_elem)
           ? list_entry (list_elem, struct block, list_elem)
           : NULL);
 }
-
@@ -1,8 +1,12 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <blockstats.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,11 +57,48 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt,
+                          void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* Asynchronous requests.
+
+   A request is submitted with block_submit() and must stay in
+   place until it completes.  Its SECTOR may be changed on the way
+   to the device that carries it out.  If DONE is non-null, it is called
+   on completion, in the device's queue thread; otherwise the
+   submitter must call block_wait() on the request. */
+struct block_request
+  {
+    struct list_elem elem;              /* Element in a request queue. */
+    bool write;                         /* Write, rather than read? */
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+    void *buffer;                       /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    int64_t deadline;                   /* For the deadline scheduler. */
+    uint64_t queued;                    /* Cycle count when queued. */
+    void (*done) (struct block_request *);  /* Completion callback. */
+    void *aux;                          /* For DONE's use. */
+    struct semaphore finished;          /* Up'd on completion if no DONE. */
+  };
+
+void block_request_init (struct block_request *, bool write,
+                         block_sector_t, size_t cnt, void *buffer,
+                         void (*done) (struct block_request *), void *aux);
+void block_submit (struct block *, struct block_request *);
+void block_wait (struct block_request *);
+void block_request_complete (struct block_request *);
+
 /* Statistics. */
 void block_print_stats (void);
+void block_get_stats (struct block *, uint64_t *read_cnt,
+                      uint64_t *write_cnt);
+void block_get_blockstats (struct block *, struct blockstats *);
+void block_stats_add_time (uint32_t hist[BLOCKSTATS_BUCKETS],
+                           uint64_t cycles);
 
 /* Lower-level interface to block device drivers. */
 
@@ -65,10 +106,25 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer CNT consecutive sectors at once.  If
+       null, the block layer calls read or write once per
+       sector instead. */
+    void (*read_multiple) (void *aux, block_sector_t, size_t cnt,
+                           void *buffer);
+    void (*write_multiple) (void *aux, block_sector_t, size_t cnt,
+                            const void *buffer);
+
+    /* Optional.  Passes an asynchronous request on to another
+       block device, translating its SECTOR.  If null, requests
+       go through the device's request queue, or are carried out
+       at once if it has none. */
+    void (*submit) (void *aux, struct block_request *);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+void block_enable_queue (struct block *);
 
 #endif /* devices/block.h */
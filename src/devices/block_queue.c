@@ -0,0 +1,317 @@
+#include "devices/block_queue.h"
+#include <debug.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Request queue for a block device.
+
+   Requests submitted to a queue are carried out one at a time by
+   a kernel thread dedicated to the device.  Each time the device
+   becomes idle, the queue's scheduler picks the next request from
+   those pending, and any pending requests in the same direction
+   that continue it sector by sector are merged into the same
+   transfer, up to MERGE_MAX sectors.  Thus a caller that submits
+   many requests before waiting for them lets the device serve
+   them in an order that keeps seeks short, with few commands. */
+
+/* Most sectors in one merged transfer. */
+#define MERGE_MAX 16
+
+/* Ticks a read or a write may wait before the deadline
+   scheduler serves it ahead of the others. */
+#define READ_EXPIRE (TIMER_FREQ / 20)
+#define WRITE_EXPIRE (TIMER_FREQ / 2)
+
+/* A request scheduler. */
+struct block_scheduler
+  {
+    const char *name;           /* For the -iosched option. */
+
+    /* Returns the request in Q's pending list to serve next.
+       The list is in order of submission and is not empty. */
+    struct block_request *(*select) (struct block_queue *q);
+  };
+
+/* A request queue. */
+struct block_queue
+  {
+    block_transfer_func *transfer;      /* Driver entry point. */
+    void *aux;                          /* Passed to TRANSFER. */
+
+    struct lock lock;                   /* Protects PENDING and HEAD. */
+    struct condition nonempty;          /* Signaled on submission. */
+    struct list pending;                /* Requests not yet started. */
+    block_sector_t head;                /* Sector after the last transfer. */
+
+    /* Statistics, also protected by LOCK. */
+    uint32_t wait_hist[BLOCKSTATS_BUCKETS]; /* Requests by time queued. */
+    uint64_t wait_cycles;               /* Total time queued. */
+    uint32_t waiters;                   /* Requests in PENDING. */
+    uint32_t max_waiters;               /* Most requests in PENDING. */
+
+    uint8_t *bounce;                    /* MERGE_MAX sectors for merging. */
+  };
+
+static struct block_request *select_fifo (struct block_queue *);
+static struct block_request *select_clook (struct block_queue *);
+static struct block_request *select_deadline (struct block_queue *);
+
+/* Available schedulers. */
+static const struct block_scheduler schedulers[] =
+  {
+    {"fifo", select_fifo},
+    {"clook", select_clook},
+    {"deadline", select_deadline},
+  };
+
+/* Scheduler used by every queue. */
+static const struct block_scheduler *scheduler = &schedulers[2];
+
+static thread_func queue_thread NO_RETURN;
+static size_t take_batch (struct block_queue *, struct list *batch);
+
+/* Selects the scheduler with the given NAME for all queues.
+   Returns false if there is no such scheduler. */
+bool
+block_queue_set_scheduler (const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof schedulers / sizeof *schedulers; i++)
+    if (!strcmp (name, schedulers[i].name))
+      {
+        scheduler = &schedulers[i];
+        return true;
+      }
+  return false;
+}
+
+/* Creates a request queue that carries out requests by calling
+   TRANSFER with AUX, and starts a kernel thread named after the
+   device NAME to serve it. */
+struct block_queue *
+block_queue_create (const char *name, block_transfer_func *transfer,
+                    void *aux)
+{
+  char thread_name[16];
+  struct block_queue *q = malloc (sizeof *q);
+  if (q == NULL)
+    PANIC ("can't allocate request queue for %s", name);
+
+  q->transfer = transfer;
+  q->aux = aux;
+  lock_init (&q->lock);
+  cond_init (&q->nonempty);
+  list_init (&q->pending);
+  q->head = 0;
+  memset (q->wait_hist, 0, sizeof q->wait_hist);
+  q->wait_cycles = 0;
+  q->waiters = q->max_waiters = 0;
+  q->bounce = malloc (MERGE_MAX * BLOCK_SECTOR_SIZE);
+  if (q->bounce == NULL)
+    PANIC ("can't allocate request queue for %s", name);
+
+  snprintf (thread_name, sizeof thread_name, "blkq-%s", name);
+  thread_create (thread_name, PRI_MAX, queue_thread, q);
+  return q;
+}
+
+/* Adds R to Q.  R's callback, if any, will run in Q's thread and
+   must not wait for another request to Q. */
+void
+block_queue_submit (struct block_queue *q, struct block_request *r)
+{
+  ASSERT (!intr_context ());
+
+  r->deadline = timer_ticks () + (r->write ? WRITE_EXPIRE : READ_EXPIRE);
+  r->queued = timer_cycles ();
+  lock_acquire (&q->lock);
+  list_push_back (&q->pending, &r->elem);
+  if (++q->waiters > q->max_waiters)
+    q->max_waiters = q->waiters;
+  cond_signal (&q->nonempty, &q->lock);
+  lock_release (&q->lock);
+}
+
+/* Stores Q's wait statistics into STATS. */
+void
+block_queue_get_stats (struct block_queue *q, struct blockstats *stats)
+{
+  lock_acquire (&q->lock);
+  memcpy (stats->wait_hist, q->wait_hist, sizeof stats->wait_hist);
+  stats->wait_cycles = q->wait_cycles;
+  stats->max_waiters = q->max_waiters;
+  lock_release (&q->lock);
+}
+
+/* Records that R leaves Q's pending list for the device.  Must
+   be called with Q's lock held. */
+static void
+dequeue (struct block_queue *q, struct block_request *r)
+{
+  uint64_t waited = timer_cycles () - r->queued;
+
+  list_remove (&r->elem);
+  q->waiters--;
+  q->wait_cycles += waited;
+  block_stats_add_time (q->wait_hist, waited);
+}
+
+/* Serves the requests submitted to queue Q_. */
+static void
+queue_thread (void *q_)
+{
+  struct block_queue *q = q_;
+
+  for (;;)
+    {
+      struct list batch;
+      struct block_request *first;
+      size_t cnt;
+
+      list_init (&batch);
+      cnt = take_batch (q, &batch);
+      first = list_entry (list_front (&batch), struct block_request, elem);
+
+      if (list_size (&batch) == 1)
+        q->transfer (q->aux, first->write, first->sector, cnt,
+                     first->buffer);
+      else
+        {
+          /* Gather or scatter the requests through the bounce
+             buffer, so the driver sees one transfer. */
+          struct list_elem *e;
+          uint8_t *p;
+
+          if (first->write)
+            for (p = q->bounce, e = list_begin (&batch);
+                 e != list_end (&batch); e = list_next (e))
+              {
+                struct block_request *r
+                  = list_entry (e, struct block_request, elem);
+                memcpy (p, r->buffer, r->cnt * BLOCK_SECTOR_SIZE);
+                p += r->cnt * BLOCK_SECTOR_SIZE;
+              }
+          q->transfer (q->aux, first->write, first->sector, cnt, q->bounce);
+          if (!first->write)
+            for (p = q->bounce, e = list_begin (&batch);
+                 e != list_end (&batch); e = list_next (e))
+              {
+                struct block_request *r
+                  = list_entry (e, struct block_request, elem);
+                memcpy (r->buffer, p, r->cnt * BLOCK_SECTOR_SIZE);
+                p += r->cnt * BLOCK_SECTOR_SIZE;
+              }
+        }
+
+      while (!list_empty (&batch))
+        block_request_complete (list_entry (list_pop_front (&batch),
+                                            struct block_request, elem));
+    }
+}
+
+/* Waits for Q to have a pending request, then moves the request
+   chosen by the scheduler to BATCH, followed by the pending
+   requests that can be merged with it, in sector order.  Returns
+   the number of sectors in BATCH. */
+static size_t
+take_batch (struct block_queue *q, struct list *batch)
+{
+  struct block_request *r;
+  block_sector_t end;
+  size_t cnt;
+
+  lock_acquire (&q->lock);
+  while (list_empty (&q->pending))
+    cond_wait (&q->nonempty, &q->lock);
+
+  r = scheduler->select (q);
+  dequeue (q, r);
+  list_push_back (batch, &r->elem);
+  cnt = r->cnt;
+  end = r->sector + r->cnt;
+
+  while (cnt < MERGE_MAX)
+    {
+      struct list_elem *e;
+      struct block_request *next = NULL;
+
+      for (e = list_begin (&q->pending); e != list_end (&q->pending);
+           e = list_next (e))
+        {
+          struct block_request *p = list_entry (e, struct block_request, elem);
+          if (p->sector == end && p->write == r->write
+              && cnt + p->cnt <= MERGE_MAX)
+            {
+              next = p;
+              break;
+            }
+        }
+      if (next == NULL)
+        break;
+
+      dequeue (q, next);
+      list_push_back (batch, &next->elem);
+      cnt += next->cnt;
+      end += next->cnt;
+    }
+
+  q->head = end;
+  lock_release (&q->lock);
+  return cnt;
+}
+
+/* First come, first served. */
+static struct block_request *
+select_fifo (struct block_queue *q)
+{
+  return list_entry (list_front (&q->pending), struct block_request, elem);
+}
+
+/* C-LOOK elevator: the request with the lowest sector at or
+   beyond the last transfer, or the lowest sector of all if there
+   is none, so that the disk head sweeps in one direction. */
+static struct block_request *
+select_clook (struct block_queue *q)
+{
+  struct block_request *ahead = NULL, *lowest = NULL;
+  struct list_elem *e;
+
+  for (e = list_begin (&q->pending); e != list_end (&q->pending);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (lowest == NULL || r->sector < lowest->sector)
+        lowest = r;
+      if (r->sector >= q->head && (ahead == NULL || r->sector < ahead->sector))
+        ahead = r;
+    }
+  return ahead != NULL ? ahead : lowest;
+}
+
+/* Deadline: C-LOOK, except that a request that has waited past
+   its deadline is served first.  Reads have shorter deadlines
+   than writes, because a thread is usually waiting for them. */
+static struct block_request *
+select_deadline (struct block_queue *q)
+{
+  struct block_request *expired = NULL;
+  int64_t now = timer_ticks ();
+  struct list_elem *e;
+
+  for (e = list_begin (&q->pending); e != list_end (&q->pending);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->deadline <= now
+          && (expired == NULL || r->deadline < expired->deadline))
+        expired = r;
+    }
+  return expired != NULL ? expired : select_clook (q);
+}
@@ -0,0 +1,22 @@
+#ifndef DEVICES_BLOCK_QUEUE_H
+#define DEVICES_BLOCK_QUEUE_H
+
+#include <blockstats.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Performs one transfer of CNT sectors starting at SECTOR
+   between the device identified by AUX and BUFFER. */
+typedef void block_transfer_func (void *aux, bool write,
+                                  block_sector_t sector, size_t cnt,
+                                  void *buffer);
+
+struct block_queue *block_queue_create (const char *name,
+                                        block_transfer_func *, void *aux);
+void block_queue_submit (struct block_queue *, struct block_request *);
+void block_queue_get_stats (struct block_queue *, struct blockstats *);
+
+bool block_queue_set_scheduler (const char *name);
+
+#endif /* devices/block_queue.h */
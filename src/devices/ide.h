@@ -1,6 +1,12 @@
 #ifndef DEVICES_IDE_H
 #define DEVICES_IDE_H
 
+#include <stdbool.h>
+
+/* Use bus-master DMA when the controller supports it?
+   Controlled by kernel command-line option "-nodma". */
+extern bool ide_use_dma;
+
 void ide_init (void);
 
 #endif /* devices/ide.h */
@@ -0,0 +1,163 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/io.h"
+
+/* Access to PCI configuration space through configuration
+   mechanism #1, the one used by every PC chipset since the
+   PCI 2.0 days.  See [PCI] section 3.2.2.3.2. */
+
+#define PCI_CONFIG_ADDRESS 0xcf8        /* Address port. */
+#define PCI_CONFIG_DATA 0xcfc           /* Data port. */
+
+#define PCI_BUS_CNT 256                 /* Buses per system. */
+#define PCI_DEV_CNT 32                  /* Devices per bus. */
+#define PCI_FUNC_CNT 8                  /* Functions per device. */
+
+/* Header type bit that marks a multi-function device. */
+#define PCI_HEADER_MULTIFUNCTION 0x80
+
+static uint32_t config_address (uint8_t bus, uint8_t dev, uint8_t func,
+                                uint8_t reg);
+static uint32_t read_config (uint8_t bus, uint8_t dev, uint8_t func,
+                             uint8_t reg);
+static bool find (bool (*match) (const struct pci_dev *, const void *),
+                  const void *aux, struct pci_dev *);
+
+/* Returns true if P has the class and subclass in AUX[0]
+   and AUX[1]. */
+static bool
+match_class (const struct pci_dev *p, const void *aux)
+{
+  const uint8_t *class = aux;
+  return p->class == class[0] && p->subclass == class[1];
+}
+
+/* Searches the PCI buses for a function with the given CLASS and
+   SUBCLASS.  If one is found, stores it in *P and returns true.
+   Otherwise, returns false. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, struct pci_dev *p)
+{
+  uint8_t aux[2] = {class, subclass};
+  return find (match_class, aux, p);
+}
+
+/* Returns true if P has the vendor and device IDs in AUX[0]
+   and AUX[1]. */
+static bool
+match_device (const struct pci_dev *p, const void *aux)
+{
+  const uint16_t *id = aux;
+  return p->vendor_id == id[0] && p->device_id == id[1];
+}
+
+/* Searches the PCI buses for a function with the given VENDOR_ID
+   and DEVICE_ID.  If one is found, stores it in *P and returns
+   true.  Otherwise, returns false. */
+bool
+pci_find_device (uint16_t vendor_id, uint16_t device_id, struct pci_dev *p)
+{
+  uint16_t aux[2] = {vendor_id, device_id};
+  return find (match_device, aux, p);
+}
+
+/* Returns the 32-bit configuration register REG of P.
+   REG must be a multiple of 4. */
+uint32_t
+pci_read_config (const struct pci_dev *p, uint8_t reg)
+{
+  return read_config (p->bus, p->dev, p->func, reg);
+}
+
+/* Writes VALUE to the 32-bit configuration register REG of P.
+   REG must be a multiple of 4. */
+void
+pci_write_config (const struct pci_dev *p, uint8_t reg, uint32_t value)
+{
+  outl (PCI_CONFIG_ADDRESS, config_address (p->bus, p->dev, p->func, reg));
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Returns base address register BAR (0...5) of P, as stored:
+   bit 0 is set for an I/O port base, clear for a memory base. */
+uint32_t
+pci_get_bar (const struct pci_dev *p, int bar)
+{
+  ASSERT (bar >= 0 && bar < 6);
+  return pci_read_config (p, PCI_REG_BAR0 + bar * 4);
+}
+
+/* Sets COMMAND_BITS (PCI_CMD_*) in P's command register, leaving
+   the status register alone. */
+void
+pci_enable (const struct pci_dev *p, uint16_t command_bits)
+{
+  uint32_t command = pci_read_config (p, PCI_REG_COMMAND) & 0xffff;
+  pci_write_config (p, PCI_REG_COMMAND, command | command_bits);
+}
+
+/* Returns the value to write to PCI_CONFIG_ADDRESS to access
+   configuration register REG of function FUNC of device DEV on
+   bus BUS. */
+static uint32_t
+config_address (uint8_t bus, uint8_t dev, uint8_t func, uint8_t reg)
+{
+  ASSERT (reg % 4 == 0);
+  ASSERT (dev < PCI_DEV_CNT && func < PCI_FUNC_CNT);
+  return (1u << 31) | (bus << 16) | (dev << 11) | (func << 8) | reg;
+}
+
+/* Reads configuration register REG of function FUNC of device DEV
+   on bus BUS. */
+static uint32_t
+read_config (uint8_t bus, uint8_t dev, uint8_t func, uint8_t reg)
+{
+  outl (PCI_CONFIG_ADDRESS, config_address (bus, dev, func, reg));
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Scans every function on every bus and returns the first one
+   for which MATCH returns true, storing it in *P. */
+static bool
+find (bool (*match) (const struct pci_dev *, const void *),
+      const void *aux, struct pci_dev *p)
+{
+  int bus, dev, func;
+
+  for (bus = 0; bus < PCI_BUS_CNT; bus++)
+    for (dev = 0; dev < PCI_DEV_CNT; dev++)
+      for (func = 0; func < PCI_FUNC_CNT; func++)
+        {
+          uint32_t id = read_config (bus, dev, func, PCI_REG_ID);
+          uint32_t class;
+
+          if ((id & 0xffff) == 0xffff)
+            {
+              /* No such function.  If function 0 is missing,
+                 so is the whole device. */
+              if (func == 0)
+                break;
+              continue;
+            }
+
+          class = read_config (bus, dev, func, PCI_REG_CLASS);
+          p->bus = bus;
+          p->dev = dev;
+          p->func = func;
+          p->vendor_id = id & 0xffff;
+          p->device_id = id >> 16;
+          p->class = class >> 24;
+          p->subclass = class >> 16;
+          p->prog_if = class >> 8;
+          p->irq = read_config (bus, dev, func, PCI_REG_IRQ);
+          if (match (p, aux))
+            return true;
+
+          /* Single-function devices only answer for function 0. */
+          if (func == 0
+              && !(read_config (bus, dev, 0, PCI_REG_HEADER) >> 16
+                   & PCI_HEADER_MULTIFUNCTION))
+            break;
+        }
+  return false;
+}
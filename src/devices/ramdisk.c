@@ -0,0 +1,89 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A block device kept in kernel memory.
+
+   Its contents start out zeroed and are lost at shutdown, so it
+   suits the file system (formatted with -f), scratch, and swap
+   roles when disk latency should be left out of a measurement.
+   Its pages come from the kernel pool one at a time, so they
+   need not be contiguous. */
+
+/* Sectors per page. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* A RAM disk. */
+struct ramdisk
+  {
+    uint8_t **pages;                    /* Pages holding the sectors. */
+    size_t page_cnt;                    /* Number of pages. */
+  };
+
+static struct block_operations ramdisk_operations;
+
+/* Creates and registers a RAM disk named "ram0" of KB kilobytes,
+   rounded up to a whole number of pages.  Panics if the kernel
+   pool cannot hold it. */
+void
+ramdisk_init (size_t kb)
+{
+  struct ramdisk *r;
+  size_t i;
+
+  r = malloc (sizeof *r);
+  if (r == NULL)
+    PANIC ("Failed to allocate memory for RAM disk descriptor");
+  r->page_cnt = DIV_ROUND_UP (kb * 1024, PGSIZE);
+  r->pages = malloc (r->page_cnt * sizeof *r->pages);
+  if (r->pages == NULL)
+    PANIC ("Failed to allocate memory for RAM disk page table");
+  for (i = 0; i < r->page_cnt; i++)
+    {
+      r->pages[i] = palloc_get_page (PAL_ZERO);
+      if (r->pages[i] == NULL)
+        PANIC ("RAM disk of %zu kB does not fit in kernel pool", kb);
+    }
+
+  block_register ("ram0", BLOCK_RAW, "RAM disk",
+                  r->page_cnt * SECTORS_PER_PAGE, &ramdisk_operations, r);
+}
+
+/* Returns the address of SECTOR in RAM disk R. */
+static uint8_t *
+sector_address (const struct ramdisk *r, block_sector_t sector)
+{
+  return (r->pages[sector / SECTORS_PER_PAGE]
+          + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+/* Reads sector SECTOR from RAM disk R_ into BUFFER. */
+static void
+ramdisk_read (void *r_, block_sector_t sector, void *buffer)
+{
+  struct ramdisk *r = r_;
+  memcpy (buffer, sector_address (r, sector), BLOCK_SECTOR_SIZE);
+}
+
+/* Writes sector SECTOR to RAM disk R_ from BUFFER. */
+static void
+ramdisk_write (void *r_, block_sector_t sector, const void *buffer)
+{
+  struct ramdisk *r = r_;
+  memcpy (sector_address (r, sector), buffer, BLOCK_SECTOR_SIZE);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    NULL,
+    NULL,
+    NULL
+  };
@@ -0,0 +1,245 @@
+#include "devices/stripe.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+
+/* A striped block device ("RAID 0").
+
+   Consecutive chunks of STRIPE_CHUNK sectors are spread round
+   robin over the member devices, so that chunk C lives on member
+   C % CNT.  A request that spans chunks is split into one request
+   per chunk, all submitted at once, so members on different IDE
+   channels transfer their parts in parallel. */
+
+/* Most member devices. */
+#define STRIPE_MAX 4
+
+/* Sectors per chunk: one page, so that a swap slot is never
+   split. */
+#define STRIPE_CHUNK 8
+
+/* A striped device. */
+struct stripe
+  {
+    struct block *members[STRIPE_MAX];  /* Member devices. */
+    size_t cnt;                         /* Number of members. */
+  };
+
+/* A request split into one part per chunk. */
+struct stripe_split
+  {
+    struct block_request *orig;         /* Request that was split. */
+    size_t pending;                     /* Parts not yet completed. */
+    struct block_request parts[];       /* The parts. */
+  };
+
+static struct block_operations stripe_operations;
+
+/* Creates and registers a block device for the given ROLE that
+   stripes the block devices named in NAMES, a comma-separated
+   list.  The members should be attached to different IDE
+   channels; they may also be partitions. */
+struct block *
+stripe_create (enum block_type role, const char *names)
+{
+  static int stripe_cnt;
+  char copy[128], name[16], extra_info[128];
+  char *token, *save_ptr;
+  block_sector_t chunks = 0;
+  struct stripe *s;
+  size_t i;
+
+  s = malloc (sizeof *s);
+  if (s == NULL)
+    PANIC ("Failed to allocate memory for stripe descriptor");
+  s->cnt = 0;
+
+  strlcpy (copy, names, sizeof copy);
+  extra_info[0] = '\0';
+  for (token = strtok_r (copy, ",", &save_ptr); token != NULL;
+       token = strtok_r (NULL, ",", &save_ptr))
+    {
+      struct block *block = block_get_by_name (token);
+      block_sector_t size;
+
+      if (block == NULL)
+        PANIC ("No such block device \"%s\"", token);
+      if (s->cnt >= STRIPE_MAX)
+        PANIC ("Too many devices in stripe \"%s\"", names);
+      for (i = 0; i < s->cnt; i++)
+        if (s->members[i] == block)
+          PANIC ("Device \"%s\" appears twice in stripe", token);
+
+      /* Every member contributes as many chunks as the smallest. */
+      size = block_size (block) / STRIPE_CHUNK;
+      if (s->cnt == 0 || size < chunks)
+        chunks = size;
+      s->members[s->cnt++] = block;
+      snprintf (extra_info + strlen (extra_info),
+                sizeof extra_info - strlen (extra_info),
+                "%s%s", s->cnt > 1 ? "+" : "striping ", token);
+    }
+  if (s->cnt < 2)
+    PANIC ("Stripe \"%s\" needs at least two devices", names);
+
+  snprintf (name, sizeof name, "stripe%d", stripe_cnt++);
+  return block_register (name, role, extra_info,
+                         chunks * STRIPE_CHUNK * s->cnt,
+                         &stripe_operations, s);
+}
+
+/* Returns the member of S holding SECTOR, and stores the
+   corresponding sector of that member in *MEMBER_SECTOR. */
+static struct block *
+map_sector (const struct stripe *s, block_sector_t sector,
+            block_sector_t *member_sector)
+{
+  block_sector_t chunk = sector / STRIPE_CHUNK;
+
+  *member_sector = chunk / s->cnt * STRIPE_CHUNK + sector % STRIPE_CHUNK;
+  return s->members[chunk % s->cnt];
+}
+
+/* Completes part P of a split request, and the request itself
+   once all of its parts are complete.  Parts complete in the
+   queue threads of different members, hence the interrupt
+   disabling. */
+static void
+part_done (struct block_request *p)
+{
+  struct stripe_split *split = p->aux;
+  enum intr_level old_level;
+  bool last;
+
+  old_level = intr_disable ();
+  last = --split->pending == 0;
+  intr_set_level (old_level);
+
+  if (last)
+    {
+      struct block_request *orig = split->orig;
+      free (split);
+      block_request_complete (orig);
+    }
+}
+
+/* Passes request R for stripe S_ on to the members, splitting it
+   at chunk boundaries. */
+static void
+stripe_submit (void *s_, struct block_request *r)
+{
+  struct stripe *s = s_;
+  block_sector_t first = r->sector / STRIPE_CHUNK;
+  block_sector_t last = (r->sector + r->cnt - 1) / STRIPE_CHUNK;
+  size_t part_cnt = last - first + 1;
+  struct stripe_split *split;
+  block_sector_t sector;
+  uint8_t *buffer;
+  size_t i;
+
+  if (part_cnt == 1)
+    {
+      struct block *member = map_sector (s, r->sector, &r->sector);
+      block_submit (member, r);
+      return;
+    }
+
+  split = malloc (sizeof *split + part_cnt * sizeof *split->parts);
+  if (split == NULL)
+    {
+      /* Out of memory: transfer one chunk at a time. */
+      for (sector = r->sector, buffer = r->buffer;
+           sector < r->sector + r->cnt; )
+        {
+          size_t cnt = STRIPE_CHUNK - sector % STRIPE_CHUNK;
+          block_sector_t member_sector;
+          struct block *member = map_sector (s, sector, &member_sector);
+
+          if (cnt > r->sector + r->cnt - sector)
+            cnt = r->sector + r->cnt - sector;
+          if (r->write)
+            block_write_multiple (member, member_sector, cnt, buffer);
+          else
+            block_read_multiple (member, member_sector, cnt, buffer);
+          sector += cnt;
+          buffer += cnt * BLOCK_SECTOR_SIZE;
+        }
+      block_request_complete (r);
+      return;
+    }
+
+  /* Count every part as pending before submitting any, so that
+     the request cannot complete, and SPLIT be freed, early. */
+  split->orig = r;
+  split->pending = part_cnt;
+  for (i = 0, sector = r->sector, buffer = r->buffer; i < part_cnt; i++)
+    {
+      size_t cnt = STRIPE_CHUNK - sector % STRIPE_CHUNK;
+      block_sector_t member_sector;
+      struct block *member = map_sector (s, sector, &member_sector);
+
+      if (cnt > r->sector + r->cnt - sector)
+        cnt = r->sector + r->cnt - sector;
+      block_request_init (&split->parts[i], r->write, member_sector, cnt,
+                          buffer, part_done, split);
+      sector += cnt;
+      buffer += cnt * BLOCK_SECTOR_SIZE;
+      block_submit (member, &split->parts[i]);
+    }
+}
+
+/* Transfers CNT sectors starting at SECTOR between stripe S and
+   BUFFER, and waits for all of the parts to finish. */
+static void
+stripe_transfer (struct stripe *s, bool write, block_sector_t sector,
+                 size_t cnt, void *buffer)
+{
+  struct block_request r;
+
+  block_request_init (&r, write, sector, cnt, buffer, NULL, NULL);
+  stripe_submit (s, &r);
+  block_wait (&r);
+}
+
+/* Reads sector SECTOR from stripe S into BUFFER. */
+static void
+stripe_read (void *s, block_sector_t sector, void *buffer)
+{
+  stripe_transfer (s, false, sector, 1, buffer);
+}
+
+/* Writes sector SECTOR to stripe S from BUFFER. */
+static void
+stripe_write (void *s, block_sector_t sector, const void *buffer)
+{
+  stripe_transfer (s, true, sector, 1, (void *) buffer);
+}
+
+/* Reads CNT sectors starting at SECTOR from stripe S into
+   BUFFER. */
+static void
+stripe_read_multiple (void *s, block_sector_t sector, size_t cnt,
+                      void *buffer)
+{
+  stripe_transfer (s, false, sector, cnt, buffer);
+}
+
+/* Writes CNT sectors starting at SECTOR to stripe S from
+   BUFFER. */
+static void
+stripe_write_multiple (void *s, block_sector_t sector, size_t cnt,
+                       const void *buffer)
+{
+  stripe_transfer (s, true, sector, cnt, (void *) buffer);
+}
+
+static struct block_operations stripe_operations =
+  {
+    stripe_read,
+    stripe_write,
+    stripe_read_multiple,
+    stripe_write_multiple,
+    stripe_submit
+  };
@@ -0,0 +1,438 @@
+#include "devices/virtio_blk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Driver for a virtio block device, through the legacy PCI
+   interface described in [VIRTIO] sections 2 and 5.2 and offered
+   by QEMU as "-drive if=virtio".
+
+   Requests travel over a single virtqueue: a ring of descriptor
+   chains that the device processes in any order, as many at a
+   time as it likes.  Each block request takes a chain of three
+   descriptors: a header naming the operation and sector, the
+   data, and a status byte for the device to fill in.  Submitting
+   a request only adds its chain to the ring and notifies the
+   device, so any number of requests may be in flight, up to the
+   ring's size.  The device interrupts when it puts finished
+   chains in the "used" ring; a kernel thread then completes the
+   corresponding requests, because completion callbacks may
+   sleep. */
+
+/* PCI identification of a legacy virtio block device. */
+#define VIRTIO_VENDOR_ID 0x1af4
+#define VIRTIO_BLK_DEVICE_ID 0x1001
+
+/* Legacy virtio registers, relative to the I/O base in BAR 0. */
+#define REG_DEVICE_FEATURES 0x00        /* 32 bits. */
+#define REG_GUEST_FEATURES 0x04         /* 32 bits. */
+#define REG_QUEUE_PFN 0x08              /* 32 bits. */
+#define REG_QUEUE_SIZE 0x0c             /* 16 bits. */
+#define REG_QUEUE_SELECT 0x0e           /* 16 bits. */
+#define REG_QUEUE_NOTIFY 0x10           /* 16 bits. */
+#define REG_STATUS 0x12                 /* 8 bits. */
+#define REG_ISR 0x13                    /* 8 bits. */
+#define REG_CAPACITY 0x14               /* 64 bits, in sectors. */
+
+/* Device status bits. */
+#define STATUS_ACKNOWLEDGE 0x01         /* Guest noticed the device. */
+#define STATUS_DRIVER 0x02              /* Guest has a driver for it. */
+#define STATUS_DRIVER_OK 0x04           /* Driver is ready. */
+#define STATUS_FAILED 0x80              /* Driver gave up. */
+
+/* Interrupt status bits. */
+#define ISR_QUEUE 0x01                  /* Used ring was updated. */
+
+/* Virtqueue alignment in the legacy interface. */
+#define VRING_ALIGN 4096
+
+/* A descriptor: one physically contiguous buffer. */
+struct vring_desc
+  {
+    uint64_t addr;                      /* Physical address. */
+    uint32_t len;                       /* Length in bytes. */
+    uint16_t flags;                     /* VRING_DESC_F_*. */
+    uint16_t next;                      /* Next in chain, if F_NEXT. */
+  };
+
+#define VRING_DESC_F_NEXT 1             /* Chain continues in NEXT. */
+#define VRING_DESC_F_WRITE 2            /* Device writes the buffer. */
+
+/* Chains offered to the device. */
+struct vring_avail
+  {
+    uint16_t flags;
+    uint16_t idx;                       /* Where the next entry goes. */
+    uint16_t ring[];                    /* Heads of chains. */
+  };
+
+/* Chains handed back by the device. */
+struct vring_used_elem
+  {
+    uint32_t id;                        /* Head of chain. */
+    uint32_t len;                       /* Bytes written to chain. */
+  };
+
+struct vring_used
+  {
+    uint16_t flags;
+    uint16_t idx;                       /* Where the next entry goes. */
+    struct vring_used_elem ring[];
+  };
+
+/* Block request header, read by the device. */
+struct virtio_blk_header
+  {
+    uint32_t type;                      /* VIRTIO_BLK_T_*. */
+    uint32_t reserved;
+    uint64_t sector;                    /* First sector. */
+  };
+
+#define VIRTIO_BLK_T_IN 0               /* Read. */
+#define VIRTIO_BLK_T_OUT 1              /* Write. */
+
+#define VIRTIO_BLK_S_OK 0               /* Request succeeded. */
+
+/* Descriptors per request: header, data, status. */
+#define DESCS_PER_REQUEST 3
+
+/* A virtio block device. */
+struct virtio_blk
+  {
+    uint16_t base;                      /* I/O base port. */
+    uint16_t size;                      /* Virtqueue size. */
+
+    struct vring_desc *desc;            /* Descriptor table. */
+    struct vring_avail *avail;          /* Available ring. */
+    struct vring_used *used;            /* Used ring. */
+
+    /* Indexed by head descriptor of a request's chain. */
+    struct block_request **requests;    /* Requests in flight. */
+    struct virtio_blk_header *headers;  /* Their headers. */
+    uint8_t *status;                    /* Their status bytes. */
+
+    struct lock lock;                   /* Protects all below. */
+    struct condition desc_free;         /* Signaled when FREE_CNT grows. */
+    uint16_t free_head;                 /* First free descriptor. */
+    uint16_t free_cnt;                  /* Number of free descriptors. */
+    uint16_t used_idx;                  /* Next used entry to look at. */
+
+    struct semaphore interrupted;       /* Up'd by interrupt handler. */
+  };
+
+/* The device, if any.  Only one is supported. */
+static struct virtio_blk *vblk;
+
+static struct block_operations virtio_blk_operations;
+
+static bool init_queue (struct virtio_blk *);
+static intr_handler_func interrupt_handler;
+static thread_func completion_thread NO_RETURN;
+
+/* Finds and initializes a virtio block device, if there is one,
+   and registers it as "vda". */
+void
+virtio_blk_init (void)
+{
+  struct pci_dev pci;
+  struct virtio_blk *d;
+  struct block *block;
+  uint64_t capacity;
+  uint32_t bar;
+
+  if (!pci_find_device (VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID, &pci))
+    return;
+  bar = pci_get_bar (&pci, 0);
+  if (!(bar & 1) || pci.irq == 0 || pci.irq >= 16)
+    {
+      printf ("virtio-blk: unusable device\n");
+      return;
+    }
+  pci_enable (&pci, PCI_CMD_IO | PCI_CMD_BUS_MASTER);
+
+  d = malloc (sizeof *d);
+  if (d == NULL)
+    PANIC ("Failed to allocate memory for virtio-blk descriptor");
+  d->base = bar & ~3u;
+  lock_init (&d->lock);
+  cond_init (&d->desc_free);
+  sema_init (&d->interrupted, 0);
+
+  /* Reset the device and tell it we know how to drive it.  We
+     need no optional features. */
+  outb (d->base + REG_STATUS, 0);
+  outb (d->base + REG_STATUS, STATUS_ACKNOWLEDGE);
+  outb (d->base + REG_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+  outl (d->base + REG_GUEST_FEATURES, 0);
+
+  if (!init_queue (d))
+    {
+      printf ("virtio-blk: can't set up virtqueue\n");
+      outb (d->base + REG_STATUS, STATUS_FAILED);
+      free (d);
+      return;
+    }
+
+  vblk = d;
+  intr_register_ext (0x20 + pci.irq, interrupt_handler, "virtio-blk");
+  thread_create ("virtio-blk", PRI_MAX, completion_thread, d);
+  outb (d->base + REG_STATUS,
+        STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+
+  capacity = inl (d->base + REG_CAPACITY)
+             | (uint64_t) inl (d->base + REG_CAPACITY + 4) << 32;
+  if (capacity > (block_sector_t) -1)
+    capacity = (block_sector_t) -1;
+  block = block_register ("vda", BLOCK_RAW, "virtio", capacity,
+                          &virtio_blk_operations, d);
+  partition_scan (block);
+}
+
+/* Sets up virtqueue 0 of D.  Returns false on failure. */
+static bool
+init_queue (struct virtio_blk *d)
+{
+  size_t desc_size, avail_size, used_size, used_ofs, page_cnt;
+  uint8_t *ring;
+  uint16_t i;
+
+  outw (d->base + REG_QUEUE_SELECT, 0);
+  d->size = inw (d->base + REG_QUEUE_SIZE);
+  if (d->size < DESCS_PER_REQUEST)
+    return false;
+
+  /* Legacy layout: descriptor table and available ring, then the
+     used ring at the next VRING_ALIGN boundary, all physically
+     contiguous. */
+  desc_size = d->size * sizeof *d->desc;
+  avail_size = sizeof *d->avail + (d->size + 1) * sizeof (uint16_t);
+  used_size = (sizeof *d->used + d->size * sizeof (struct vring_used_elem)
+               + sizeof (uint16_t));
+  used_ofs = ROUND_UP (desc_size + avail_size, VRING_ALIGN);
+  page_cnt = DIV_ROUND_UP (used_ofs + used_size, PGSIZE);
+  ring = palloc_get_multiple (PAL_ZERO, page_cnt);
+  if (ring == NULL)
+    return false;
+  d->desc = (struct vring_desc *) ring;
+  d->avail = (struct vring_avail *) (ring + desc_size);
+  d->used = (struct vring_used *) (ring + used_ofs);
+
+  d->requests = calloc (d->size, sizeof *d->requests);
+  d->headers = calloc (d->size, sizeof *d->headers);
+  d->status = calloc (d->size, sizeof *d->status);
+  if (d->requests == NULL || d->headers == NULL || d->status == NULL)
+    {
+      free (d->requests);
+      free (d->headers);
+      free (d->status);
+      palloc_free_multiple (ring, page_cnt);
+      return false;
+    }
+
+  /* Chain all the descriptors into the free list. */
+  for (i = 0; i + 1 < d->size; i++)
+    d->desc[i].next = i + 1;
+  d->free_head = 0;
+  d->free_cnt = d->size;
+  d->used_idx = 0;
+
+  outl (d->base + REG_QUEUE_PFN, vtop (ring) / VRING_ALIGN);
+  return true;
+}
+
+/* Takes a descriptor off D's free list and fills it in to
+   describe the SIZE bytes at kernel address P, with FLAGS.
+   Returns its index. */
+static uint16_t
+alloc_desc (struct virtio_blk *d, const void *p, size_t size,
+            uint16_t flags)
+{
+  uint16_t i = d->free_head;
+
+  ASSERT (d->free_cnt > 0);
+  d->free_head = d->desc[i].next;
+  d->free_cnt--;
+
+  d->desc[i].addr = vtop (p);
+  d->desc[i].len = size;
+  d->desc[i].flags = flags;
+  return i;
+}
+
+/* Adds R to D's virtqueue and notifies the device.  R's buffer,
+   like all kernel memory, is physically contiguous, so it needs
+   just one descriptor. */
+static void
+virtio_blk_submit (void *d_, struct block_request *r)
+{
+  struct virtio_blk *d = d_;
+  uint16_t head, data;
+
+  ASSERT (!intr_context ());
+  ASSERT (is_kernel_vaddr (r->buffer));
+
+  lock_acquire (&d->lock);
+  while (d->free_cnt < DESCS_PER_REQUEST)
+    cond_wait (&d->desc_free, &d->lock);
+
+  /* The header and status byte are named after the chain's head
+     descriptor, which is the first to be allocated. */
+  head = d->free_head;
+  d->headers[head].type = r->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  d->headers[head].reserved = 0;
+  d->headers[head].sector = r->sector;
+  alloc_desc (d, &d->headers[head], sizeof d->headers[head],
+              VRING_DESC_F_NEXT);
+
+  data = alloc_desc (d, r->buffer, r->cnt * BLOCK_SECTOR_SIZE,
+                     VRING_DESC_F_NEXT | (r->write ? 0 : VRING_DESC_F_WRITE));
+  d->desc[head].next = data;
+  d->status[head] = 0xff;
+  d->desc[data].next = alloc_desc (d, &d->status[head], 1,
+                                   VRING_DESC_F_WRITE);
+  d->requests[head] = r;
+
+  /* The device must see the chain before the ring entry, and the
+     entry before the index. */
+  d->avail->ring[d->avail->idx % d->size] = head;
+  barrier ();
+  d->avail->idx++;
+  barrier ();
+  outw (d->base + REG_QUEUE_NOTIFY, 0);
+  lock_release (&d->lock);
+}
+
+/* Returns the chain starting at descriptor HEAD to D's free
+   list. */
+static void
+free_chain (struct virtio_blk *d, uint16_t head)
+{
+  uint16_t i = head;
+
+  for (;;)
+    {
+      bool more = d->desc[i].flags & VRING_DESC_F_NEXT;
+      uint16_t next = d->desc[i].next;
+
+      d->desc[i].next = d->free_head;
+      d->free_head = i;
+      d->free_cnt++;
+      if (!more)
+        break;
+      i = next;
+    }
+}
+
+/* Completes the requests that device D_ has handed back, each
+   time it interrupts. */
+static void
+completion_thread (void *d_)
+{
+  struct virtio_blk *d = d_;
+
+  for (;;)
+    {
+      struct list done;
+
+      sema_down (&d->interrupted);
+
+      list_init (&done);
+      lock_acquire (&d->lock);
+      while (d->used_idx != d->used->idx)
+        {
+          struct vring_used_elem *e;
+          struct block_request *r;
+
+          barrier ();
+          e = &d->used->ring[d->used_idx % d->size];
+          r = d->requests[e->id];
+          if (d->status[e->id] != VIRTIO_BLK_S_OK)
+            PANIC ("vda: %s failed, sector=%"PRDSNu", status=%d",
+                   r->write ? "write" : "read", r->sector,
+                   d->status[e->id]);
+          d->requests[e->id] = NULL;
+          free_chain (d, e->id);
+          list_push_back (&done, &r->elem);
+          d->used_idx++;
+        }
+      cond_broadcast (&d->desc_free, &d->lock);
+      lock_release (&d->lock);
+
+      while (!list_empty (&done))
+        block_request_complete (list_entry (list_pop_front (&done),
+                                            struct block_request, elem));
+    }
+}
+
+/* Reading the interrupt status register acknowledges the
+   interrupt. */
+static void
+interrupt_handler (struct intr_frame *f UNUSED)
+{
+  if (vblk != NULL && (inb (vblk->base + REG_ISR) & ISR_QUEUE))
+    sema_up (&vblk->interrupted);
+}
+
+/* Transfers CNT sectors starting at SECTOR between device D and
+   BUFFER, and waits for the transfer to finish. */
+static void
+virtio_blk_transfer (struct virtio_blk *d, bool write, block_sector_t sector,
+                     size_t cnt, void *buffer)
+{
+  struct block_request r;
+
+  block_request_init (&r, write, sector, cnt, buffer, NULL, NULL);
+  virtio_blk_submit (d, &r);
+  block_wait (&r);
+}
+
+/* Reads sector SECTOR from device D into BUFFER. */
+static void
+virtio_blk_read (void *d, block_sector_t sector, void *buffer)
+{
+  virtio_blk_transfer (d, false, sector, 1, buffer);
+}
+
+/* Writes sector SECTOR to device D from BUFFER. */
+static void
+virtio_blk_write (void *d, block_sector_t sector, const void *buffer)
+{
+  virtio_blk_transfer (d, true, sector, 1, (void *) buffer);
+}
+
+/* Reads CNT sectors starting at SECTOR from device D into
+   BUFFER. */
+static void
+virtio_blk_read_multiple (void *d, block_sector_t sector, size_t cnt,
+                          void *buffer)
+{
+  virtio_blk_transfer (d, false, sector, cnt, buffer);
+}
+
+/* Writes CNT sectors starting at SECTOR to device D from
+   BUFFER. */
+static void
+virtio_blk_write_multiple (void *d, block_sector_t sector, size_t cnt,
+                           const void *buffer)
+{
+  virtio_blk_transfer (d, true, sector, cnt, (void *) buffer);
+}
+
+static struct block_operations virtio_blk_operations =
+  {
+    virtio_blk_read,
+    virtio_blk_write,
+    virtio_blk_read_multiple,
+    virtio_blk_write_multiple,
+    virtio_blk_submit
+  };
@@ -0,0 +1,53 @@
+/* iostat.c
+
+   Prints statistics for each block device named on the command
+   line, which may also name a role such as "filesys".  Times are
+   given as log2 histograms of CPU cycles. */
+
+#include <stdio.h>
+#include <syscall.h>
+
+static void print_hist (const char *name, const uint32_t *hist);
+
+int
+main (int argc, char *argv[])
+{
+  bool success = true;
+  int i;
+
+  for (i = 1; i < argc; i++)
+    {
+      struct blockstats stats;
+
+      if (!blockstats (argv[i], &stats))
+        {
+          printf ("%s: no such block device\n", argv[i]);
+          success = false;
+          continue;
+        }
+
+      printf ("%s: %llu sectors read, %llu sectors written\n",
+              argv[i], stats.read_cnt, stats.write_cnt);
+      printf ("  %llu cycles per tick, %llu cycles queued, "
+              "at most %u waiting\n",
+              stats.cycles_per_tick, stats.wait_cycles,
+              (unsigned) stats.max_waiters);
+      print_hist ("read time", stats.read_hist);
+      print_hist ("write time", stats.write_hist);
+      print_hist ("queue wait", stats.wait_hist);
+    }
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Prints the nonempty buckets of HIST, labeled NAME. */
+static void
+print_hist (const char *name, const uint32_t *hist)
+{
+  int i;
+
+  printf ("  %s:", name);
+  for (i = 0; i < BLOCKSTATS_BUCKETS; i++)
+    if (hist[i] != 0)
+      printf (" 2^%d:%u", i, (unsigned) hist[i]);
+  printf ("\n");
+}
@@ -1,48 +1,184 @@
 #include "filesys/buffer_cache.h"
+#include <stdlib.h>
 #include <string.h>
+#include "filesys/journal.h"
 #include "threads/malloc.h"
-
-#define BUFFER_CACHE_ENTRY_NB 64
+#include "threads/vaddr.h"
 
 void *p_buffer_cache;
 struct buffer_head buffer_head[BUFFER_CACHE_ENTRY_NB];
 //struct buffer_head *clock_hand;
 int clock_hand;
+/* Protects the sector of every buffer head and CLOCK_HAND. */
+static struct lock bc_lock;
+/* Signaled, if BC_WAITERS is nonzero, when a buffer is unlocked or
+   unpinned, for threads that found no victim. */
+static struct condition bc_cond;
+static int bc_waiters;
+
+static struct buffer_head *bc_try_victim (void);
+static void bc_unlock (struct buffer_head *);
+static void bc_bind (struct buffer_head *, block_sector_t);
+static bool bc_store (block_sector_t, const void *, int, int, bool);
+
+/* Returns the buffer holding SECTOR, reading it in on a miss,
+   with the buffer's lock held.  BC_LOCK only protects the
+   mapping from sectors to buffers; it is never held while
+   waiting for a buffer lock, so a thread filling one buffer does
+   not stall hits on the others. */
+static struct buffer_head *bc_get (block_sector_t sector)
+{
+	struct buffer_head *bh;
+	struct buffer_head *fill[BC_FILL_MAX];
+	uint8_t *bounce;
+	size_t cnt, i;
+
+	while (true)
+	{
+		lock_acquire(&bc_lock);
+		bh = bc_lookup(sector);
+		if (bh == NULL)
+		{
+			/* Waiting for a victim releases BC_LOCK, so look the
+			   sector up again afterward. */
+			bh = bc_select_victim();
+			if (bh != NULL)
+				break;
+			lock_release(&bc_lock);
+			continue;
+		}
+		lock_release(&bc_lock);
+
+		/* The buffer may have been recycled while we slept. */
+		lock_acquire(&bh->lock);
+		if (bh->valid && bh->sector == sector)
+			return bh;
+		bc_unlock(bh);
+	}
+
+	/* Miss.  Write back the victim while still holding BC_LOCK,
+	   so that nobody can re-read its old sector from disk before
+	   the new contents reach it. */
+	bc_bind(bh, sector);
+	fill[0] = bh;
+	cnt = 1;
+
+	/* If the previous sector is cached, the reader is probably
+	   going sequentially, so fill the following uncached sectors
+	   too, with the same disk command, as long as victims are
+	   free for the taking. */
+	if (sector > 0 && bc_lookup(sector - 1) != NULL)
+		while (cnt < BC_FILL_MAX && sector + cnt < block_size(fs_device)
+		       && bc_lookup(sector + cnt) == NULL)
+		{
+			fill[cnt] = bc_try_victim();
+			if (fill[cnt] == NULL)
+				break;
+			bc_bind(fill[cnt], sector + cnt);
+			fill[cnt]->clock = false;
+			cnt++;
+		}
+	lock_release(&bc_lock);
+
+	bounce = cnt > 1 ? malloc(cnt * BLOCK_SECTOR_SIZE) : NULL;
+	if (bounce != NULL)
+	{
+		block_read_multiple(fs_device, sector, cnt, bounce);
+		for (i = 0; i < cnt; i++)
+			memcpy(fill[i]->buffer, bounce + i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE);
+		free(bounce);
+	}
+	else
+		for (i = 0; i < cnt; i++)
+			block_read(fs_device, sector + i, fill[i]->buffer);
+
+	for (i = 1; i < cnt; i++)
+		bc_unlock(fill[i]);
+	return bh;
+}
+
+/* Writes back BH, a victim locked by the caller, and assigns it
+   to SECTOR.  Must be called with BC_LOCK held. */
+static void bc_bind (struct buffer_head *bh, block_sector_t sector)
+{
+	bc_flush_entry(bh);
+	bh->dirty = false;
+	bh->valid = true;
+	bh->sector = sector;
+}
 
+/* Copies CHUNK_SIZE bytes at SECTOR_OFS in SECTOR_IDX to BUFFER +
+   BYTES_READ.  Returns false if out of memory.
+   User memory may fault, and the fault may need this very buffer,
+   so a user BUFFER is filled through a bounce buffer after the
+   buffer lock is released.  bc_store() does the same. */
 bool bc_read (block_sector_t sector_idx, void *buffer, off_t bytes_read, int chunk_size, int sector_ofs)
 {
 	struct buffer_head *bh;
-	if (!(bh = bc_lookup(sector_idx)))
+	void *dst = buffer + bytes_read;
+	uint8_t *bounce = NULL;
+
+	if (is_user_vaddr(dst))
 	{
-		bh = bc_select_victim();
-		bc_flush_entry(bh);
-		bh->dirty = false;
-		bh->valid = true;
-		bh->sector = sector_idx;
-		block_read(fs_device, sector_idx, bh->buffer);
+		bounce = malloc(chunk_size);
+		if (bounce == NULL)
+			return false;
 	}
-	memcpy (buffer + bytes_read, bh->buffer + sector_ofs, chunk_size);
+
+	bh = bc_get(sector_idx);
+	memcpy(bounce != NULL ? bounce : dst, bh->buffer + sector_ofs, chunk_size);
 	bh->clock = true;
+	bc_unlock(bh);
+
+	if (bounce != NULL)
+	{
+		memcpy(dst, bounce, chunk_size);
+		free(bounce);
+	}
 	return true;
 }
 
 bool bc_write (block_sector_t sector_idx, void *buffer, off_t bytes_written, int chunk_size, int sector_ofs)
 {
-	bool success = false;
+	return bc_store(sector_idx, buffer + bytes_written, chunk_size, sector_ofs, false);
+}
+
+/* Like bc_write(), but for metadata: the buffer joins the running
+   journal transaction and stays in the cache until that
+   transaction commits.  The caller must be inside
+   journal_begin(). */
+bool bc_write_meta (block_sector_t sector_idx, void *buffer, off_t bytes_written, int chunk_size, int sector_ofs)
+{
+	return bc_store(sector_idx, buffer + bytes_written, chunk_size, sector_ofs, true);
+}
+
+/* Copies CHUNK_SIZE bytes from SRC to SECTOR_OFS in SECTOR_IDX,
+   adding the buffer to the journal if META.  Returns false if out
+   of memory.  A user SRC is copied before the buffer is locked. */
+static bool bc_store (block_sector_t sector_idx, const void *src, int chunk_size, int sector_ofs, bool meta)
+{
 	struct buffer_head *bh;
-	if (!(bh = bc_lookup(sector_idx)))
+	uint8_t *bounce = NULL;
+
+	if (is_user_vaddr(src))
 	{
-		bh = bc_select_victim();
-		bc_flush_entry(bh);
-		bh->valid = true;
-		bh->sector = sector_idx;
-		block_read (fs_device, sector_idx, bh->buffer);
+		bounce = malloc(chunk_size);
+		if (bounce == NULL)
+			return false;
+		memcpy(bounce, src, chunk_size);
+		src = bounce;
 	}
-	memcpy(bh->buffer + sector_ofs, buffer + bytes_written, chunk_size);
+
+	bh = bc_get(sector_idx);
+	memcpy(bh->buffer + sector_ofs, src, chunk_size);
 	bh->clock = true;
 	bh->dirty = true;
-	success = true;
-	return success;
+	if (meta && !bh->journaled)
+		journal_add(bh);
+	bc_unlock(bh);
+
+	free(bounce);
+	return true;
 }
 
 void bc_init(void)
@@ -55,9 +191,12 @@ void bc_init(void)
 		buffer_head[i].valid = false;
 		buffer_head[i].buffer = p_buffer_cache + i * 512;
 		buffer_head[i].clock = false;
+		buffer_head[i].journaled = false;
 		lock_init(&buffer_head[i].lock);
 	}
 	clock_hand = 0;
+	lock_init(&bc_lock);
+	cond_init(&bc_cond);
 }
 
 void bc_term(void)
@@ -66,29 +205,87 @@ void bc_term(void)
 	free(p_buffer_cache);
 }
 
+/* Returns a victim from bc_try_victim(), with its lock held.  If
+   every buffer is locked or pinned by the journal, instead waits
+   until one is unlocked or unpinned and returns a null pointer,
+   because BC_LOCK was released meanwhile.  Must be called with
+   BC_LOCK held. */
 struct buffer_head *bc_select_victim (void)
 {
-	while(true)
+	struct buffer_head *bh = bc_try_victim();
+
+	if (bh != NULL)
+		return bh;
+
+	/* Look once more after counting ourselves as a waiter, so that
+	   a buffer unlocked before the count went up is not missed. */
+	bc_waiters++;
+	bh = bc_try_victim();
+	if (bh == NULL)
+		cond_wait(&bc_cond, &bc_lock);
+	bc_waiters--;
+	return bh;
+}
+
+/* Runs the clock over the buffers and returns the first one that
+   is unused or not recently used, with its lock held.  Locked
+   buffers and buffers pinned by the journal are skipped.  Returns
+   a null pointer if two sweeps find no victim.  Must be called
+   with BC_LOCK held. */
+static struct buffer_head *bc_try_victim (void)
+{
+	int n;
+
+	for (n = 0; n < 2 * BUFFER_CACHE_ENTRY_NB; n++)
 	{
-		if(!buffer_head[clock_hand].valid || !buffer_head[clock_hand].clock)
-		{
-			return &buffer_head[clock_hand];
-		}
-		buffer_head[clock_hand].clock = false;
+		struct buffer_head *bh = &buffer_head[clock_hand];
 		clock_hand = (clock_hand + 1) % BUFFER_CACHE_ENTRY_NB;
-		/*if (clock_hand == buffer_head + BUFFER_CACHE_ENTRY_NB)
+		if (lock_held_by_current_thread(&bh->lock)
+		    || !lock_try_acquire(&bh->lock))
+			continue;
+		if (bh->journaled)
 		{
-			clock_hand = buffer_head;
+			lock_release(&bh->lock);
+			continue;
 		}
-		if(!clock_hand->valid || !clock_hand->clock)
+		if(!bh->valid || !bh->clock)
 		{
-			return clock_hand++;
+			return bh;
 		}
-		clock_hand->clock = false;
-		clock_hand++;*/
+		bh->clock = false;
+		lock_release(&bh->lock);
+	}
+	return NULL;
+}
+
+/* Releases BH's lock and wakes any thread waiting for a victim.
+   Must not be called with BC_LOCK held. */
+static void bc_unlock (struct buffer_head *bh)
+{
+	lock_release(&bh->lock);
+	if (bc_waiters > 0)
+	{
+		lock_acquire(&bc_lock);
+		cond_broadcast(&bc_cond, &bc_lock);
+		lock_release(&bc_lock);
 	}
 }
 
+/* Takes BH, whose journal transaction has committed, out of the
+   journal, so that it can be evicted again. */
+void bc_unpin (struct buffer_head *bh)
+{
+	bh->journaled = false;
+	if (bc_waiters > 0)
+	{
+		lock_acquire(&bc_lock);
+		cond_broadcast(&bc_cond, &bc_lock);
+		lock_release(&bc_lock);
+	}
+}
+
+/* Returns the buffer assigned to SECTOR, or a null pointer.
+   Must be called with BC_LOCK held. */
 struct buffer_head* bc_lookup(block_sector_t sector)
 {
 	int i;
@@ -102,20 +299,112 @@ struct buffer_head* bc_lookup(block_sector_t sector)
 	return NULL;
 }
 
+/* Writes P_FLUSH_ENTRY back to disk if it is dirty, unless it
+   belongs to a journal transaction that has not committed yet.
+   The caller must hold the buffer's lock. */
 void bc_flush_entry(struct buffer_head *p_flush_entry)
 {
-	if (p_flush_entry->valid && p_flush_entry->dirty)
+	if (p_flush_entry->valid && p_flush_entry->dirty && !p_flush_entry->journaled)
 	{
 		block_write(fs_device, p_flush_entry->sector, p_flush_entry->buffer);
 		p_flush_entry->dirty = false;
 	}
 }
 
+/* Writes every dirty buffer back to disk.  The writes are
+   submitted BC_FLUSH_BATCH at a time, in ascending sector order,
+   so that the disk queue can merge adjacent sectors. */
 void bc_flush_all_entries(void)
 {
-	int i;
-	for (i = 0; i < BUFFER_CACHE_ENTRY_NB; i++)
+	block_sector_t sectors[BUFFER_CACHE_ENTRY_NB];
+	size_t cnt = bc_dirty_sectors(sectors);
+	struct block_request *reqs;
+	struct buffer_head *held[BC_FLUSH_BATCH];
+	size_t i, n;
+
+	reqs = malloc(BC_FLUSH_BATCH * sizeof *reqs);
+	if (reqs == NULL)
 	{
-		bc_flush_entry(&buffer_head[i]);
+		for (i = 0; i < cnt; i++)
+			bc_flush_sector(sectors[i]);
+		return;
 	}
+
+	for (i = 0; i < cnt; )
+	{
+		for (n = 0; n < BC_FLUSH_BATCH && i < cnt; i++)
+		{
+			struct buffer_head *bh;
+
+			lock_acquire(&bc_lock);
+			bh = bc_lookup(sectors[i]);
+			lock_release(&bc_lock);
+			if (bh == NULL)
+				continue;
+
+			lock_acquire(&bh->lock);
+			if (bh->valid && bh->sector == sectors[i] && bh->dirty && !bh->journaled)
+			{
+				block_request_init(&reqs[n], true, bh->sector, 1, bh->buffer, NULL, NULL);
+				block_submit(fs_device, &reqs[n]);
+				held[n++] = bh;
+			}
+			else
+				bc_unlock(bh);
+		}
+
+		while (n > 0)
+		{
+			n--;
+			block_wait(&reqs[n]);
+			held[n]->dirty = false;
+			bc_unlock(held[n]);
+		}
+	}
+	free(reqs);
+}
+
+/* Orders two block_sector_t's, for qsort() and bsearch(). */
+int compare_sectors (const void *a_, const void *b_)
+{
+	const block_sector_t *a = a_;
+	const block_sector_t *b = b_;
+
+	return *a < *b ? -1 : *a > *b;
+}
+
+/* Stores the sectors of the dirty buffers into SECTORS, which
+   must have room for BUFFER_CACHE_ENTRY_NB of them, in ascending
+   order, and returns how many there are.  This is only a
+   snapshot: buffers may be dirtied or written back meanwhile. */
+size_t bc_dirty_sectors(block_sector_t *sectors)
+{
+	size_t cnt = 0;
+	int i;
+
+	lock_acquire(&bc_lock);
+	for (i = 0; i < BUFFER_CACHE_ENTRY_NB; i++)
+		if (buffer_head[i].valid && buffer_head[i].dirty)
+			sectors[cnt++] = buffer_head[i].sector;
+	lock_release(&bc_lock);
+
+	qsort(sectors, cnt, sizeof *sectors, compare_sectors);
+	return cnt;
+}
+
+/* Writes SECTOR back to disk if it is cached and dirty. */
+void bc_flush_sector(block_sector_t sector)
+{
+	struct buffer_head *bh;
+
+	lock_acquire(&bc_lock);
+	bh = bc_lookup(sector);
+	lock_release(&bc_lock);
+	if (bh == NULL)
+		return;
+
+	lock_acquire(&bh->lock);
+	if (bh->sector == sector)
+		bc_flush_entry(bh);
+	bc_unlock(bh);
 }
@@ -5,6 +5,12 @@
 #include "filesys/inode.h"
 #include "threads/synch.h"
 
+#define BUFFER_CACHE_ENTRY_NB 64
+/* Most sectors read by one sequential fill. */
+#define BC_FILL_MAX 8
+/* Most buffers written back by one batch of requests. */
+#define BC_FLUSH_BATCH 16
+
 struct buffer_head
 {
 	bool dirty;
@@ -13,15 +19,21 @@ struct buffer_head
 	bool clock;
 	struct lock lock;
 	void *buffer;
+	bool journaled;     /* In the running journal transaction. */
 };
 
 bool bc_read(block_sector_t, void *, off_t, int, int);
 bool bc_write(block_sector_t, void *, off_t, int, int);
+bool bc_write_meta(block_sector_t, void *, off_t, int, int);
 void bc_init(void);
 void bc_term(void);
 struct buffer_head *bc_select_victim(void);
+void bc_unpin(struct buffer_head *);
 struct buffer_head *bc_lookup(block_sector_t);
 void bc_flush_entry(struct buffer_head *);
 void bc_flush_all_entries(void);
+size_t bc_dirty_sectors(block_sector_t *);
+int compare_sectors(const void *, const void *);
+void bc_flush_sector(block_sector_t);
 
 #endif
@@ -2,15 +2,21 @@
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <round.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 
+/* Format given to newly created directories. */
+enum dir_format dir_format = DIR_FMT_FIXED;
+
 /* A directory. */
 struct dir 
   {
     struct inode *inode;                /* Backing store. */
     off_t pos;                          /* Current position. */
+    enum dir_format format;             /* On-disk entry format. */
   };
 
 /* A single directory entry. */
@@ -21,12 +27,42 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* A variable-length directory record, as in ext2.
+   Records never span sectors: each sector of a DIR_FMT_VAR
+   directory is a chain of records whose REC_LEN fields add up to
+   exactly BLOCK_SECTOR_SIZE, the last record absorbing any slack.
+   A free record has INODE_SECTOR 0, which is safe because sector
+   0 holds the free map's inode and never names a directory
+   member.  Only the first record of a sector is ever free; any
+   other removed record is merged into its predecessor. */
+struct dir_rec
+  {
+    block_sector_t inode_sector;        /* Sector number of header, or 0. */
+    uint16_t rec_len;                   /* Bytes from here to next record. */
+    uint8_t name_len;                   /* Length of NAME. */
+    uint8_t unused;                     /* Padding. */
+    char name[];                        /* File name, not null terminated. */
+  };
+
+/* Bytes needed for a record holding a NAME_LEN byte name.  This
+   is less than a fixed struct dir_entry's 20 bytes for names of up
+   to 8 bytes, the same for 9 to 12, and 24 bytes, more than a
+   fixed entry, for names of 13 or 14 (NAME_MAX) bytes. */
+#define DIR_REC_LEN(NAME_LEN) ROUND_UP (sizeof (struct dir_rec) + (NAME_LEN), 4)
+
 /* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+   given SECTOR, using the current dir_format.
+   Returns true if successful, false on failure. */
 bool
 dir_create (block_sector_t sector, size_t entry_cnt)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry), 1);
+  if (dir_format == DIR_FMT_VAR)
+    return inode_create (sector,
+                         ROUND_UP (entry_cnt * DIR_REC_LEN (NAME_MAX),
+                                   BLOCK_SECTOR_SIZE),
+                         DIR_FMT_VAR);
+  return inode_create (sector, entry_cnt * sizeof (struct dir_entry),
+                       DIR_FMT_FIXED);
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -39,6 +75,8 @@ dir_open (struct inode *inode)
     {
       dir->inode = inode;
       dir->pos = 0;
+      dir->format = (inode_dir_format (inode) == DIR_FMT_VAR
+                     ? DIR_FMT_VAR : DIR_FMT_FIXED);
       return dir;
     }
   else
@@ -83,6 +121,259 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
+/* Returns the on-disk entry format of DIR. */
+enum dir_format
+dir_get_format (struct dir *dir)
+{
+  return dir->format;
+}
+
+static bool dir_is_empty (struct inode *);
+
+/* Prepares to remove INODE from its directory, whose lock the
+   caller holds.  A directory may only be removed while empty, so
+   it is locked and checked here and stays locked, keeping it
+   empty, until end_remove().  Returns false, leaving nothing
+   locked, if INODE is a directory that is not empty. */
+static bool
+begin_remove (struct inode *inode)
+{
+  if (!inode_is_dir (inode))
+    return true;
+  inode_lock_dir (inode);
+  if (dir_is_empty (inode))
+    return true;
+  inode_unlock_dir (inode);
+  return false;
+}
+
+/* Ends what begin_remove() started. */
+static void
+end_remove (struct inode *inode)
+{
+  if (inode_is_dir (inode))
+    inode_unlock_dir (inode);
+}
+
+/* Variable-length record helpers. */
+
+/* Reads the directory sector at byte offset SEC_OFS of DIR into
+   SECTOR, which must have room for BLOCK_SECTOR_SIZE bytes.
+   A sector that has never been written (all zeros) is returned
+   as a single free record.  Returns false at end of file. */
+static bool
+rec_read_sector (const struct dir *dir, off_t sec_ofs, uint8_t *sector)
+{
+  struct dir_rec *r = (struct dir_rec *) sector;
+
+  if (inode_read_at (dir->inode, sector, BLOCK_SECTOR_SIZE, sec_ofs)
+      != BLOCK_SECTOR_SIZE)
+    return false;
+  if (r->rec_len == 0)
+    {
+      r->inode_sector = 0;
+      r->rec_len = BLOCK_SECTOR_SIZE;
+      r->name_len = 0;
+    }
+  return true;
+}
+
+/* Returns the record after R in SECTOR, or a null pointer if R
+   is the last record in SECTOR. */
+static struct dir_rec *
+rec_next (uint8_t *sector, struct dir_rec *r)
+{
+  uint8_t *next = (uint8_t *) r + r->rec_len;
+
+  if (r->rec_len < sizeof *r || next >= sector + BLOCK_SECTOR_SIZE)
+    return NULL;
+  return (struct dir_rec *) next;
+}
+
+/* Searches variable-length DIR for NAME.
+   If successful, returns true, leaves the sector holding the
+   record in SECTOR, sets *SEC_OFSP to that sector's byte offset
+   within DIR, and sets *RECP to the record and *PREVP to the
+   record before it in the same sector (or a null pointer if it
+   is the sector's first record).  Returns false otherwise. */
+static bool
+rec_find (const struct dir *dir, const char *name, uint8_t *sector,
+          off_t *sec_ofsp, struct dir_rec **recp, struct dir_rec **prevp)
+{
+  size_t name_len = strlen (name);
+  off_t sec_ofs;
+
+  for (sec_ofs = 0; rec_read_sector (dir, sec_ofs, sector);
+       sec_ofs += BLOCK_SECTOR_SIZE)
+    {
+      struct dir_rec *r, *prev = NULL;
+
+      for (r = (struct dir_rec *) sector; r != NULL;
+           prev = r, r = rec_next (sector, r))
+        if (r->inode_sector != 0 && r->name_len == name_len
+            && !memcmp (r->name, name, name_len))
+          {
+            *sec_ofsp = sec_ofs;
+            *recp = r;
+            *prevp = prev;
+            return true;
+          }
+    }
+  return false;
+}
+
+/* Adds NAME to variable-length DIR, pointing to INODE_SECTOR.
+   Fails if NAME is already in use.  Splits the slack off the
+   first record with enough room, or appends a new sector if no
+   record has room. */
+static bool
+rec_add (struct dir *dir, const char *name, block_sector_t inode_sector)
+{
+  size_t name_len = strlen (name);
+  size_t need = DIR_REC_LEN (name_len);
+  uint8_t *sector;
+  struct dir_rec *r, *new = NULL;
+  off_t sec_ofs;
+  bool success;
+
+  sector = malloc (BLOCK_SECTOR_SIZE);
+  if (sector == NULL)
+    return false;
+
+  /* Check that NAME is not in use. */
+  if (rec_find (dir, name, sector, &sec_ofs, &r, &new))
+    {
+      free (sector);
+      return false;
+    }
+  new = NULL;
+
+  for (sec_ofs = 0; new == NULL && rec_read_sector (dir, sec_ofs, sector);
+       sec_ofs += BLOCK_SECTOR_SIZE)
+    for (r = (struct dir_rec *) sector; r != NULL; r = rec_next (sector, r))
+      {
+        size_t used = r->inode_sector != 0 ? DIR_REC_LEN (r->name_len) : 0;
+        if (r->rec_len >= used + need)
+          {
+            new = (struct dir_rec *) ((uint8_t *) r + used);
+            if (used != 0)
+              {
+                new->rec_len = r->rec_len - used;
+                r->rec_len = used;
+              }
+            break;
+          }
+      }
+
+  if (new == NULL)
+    {
+      /* No room anywhere: start a new sector at end of file. */
+      memset (sector, 0, BLOCK_SECTOR_SIZE);
+      new = (struct dir_rec *) sector;
+      new->rec_len = BLOCK_SECTOR_SIZE;
+    }
+  else
+    sec_ofs -= BLOCK_SECTOR_SIZE;
+
+  new->inode_sector = inode_sector;
+  new->name_len = name_len;
+  new->unused = 0;
+  memcpy (new->name, name, name_len);
+  success = (inode_write_at (dir->inode, sector, BLOCK_SECTOR_SIZE, sec_ofs)
+             == BLOCK_SECTOR_SIZE);
+
+  free (sector);
+  return success;
+}
+
+/* Removes NAME from variable-length DIR and marks its inode for
+   removal, storing the inode into *INODE for the caller to close
+   once it has unlocked DIR.  The freed record is merged into the
+   preceding record of its sector, so free space never fragments
+   into records that are too small to reuse. */
+static bool
+rec_remove (struct dir *dir, const char *name, struct inode **inode)
+{
+  struct dir_rec *r, *prev;
+  uint8_t *sector;
+  off_t sec_ofs;
+  bool success = false;
+
+  sector = malloc (BLOCK_SECTOR_SIZE);
+  if (sector == NULL)
+    return false;
+
+  /* Find directory record. */
+  if (!rec_find (dir, name, sector, &sec_ofs, &r, &prev))
+    goto done;
+
+  /* Open inode. */
+  *inode = inode_open (r->inode_sector);
+  if (*inode == NULL || !begin_remove (*inode))
+    goto done;
+
+  /* Erase directory record. */
+  if (prev != NULL)
+    prev->rec_len += r->rec_len;
+  else
+    r->inode_sector = 0;
+  if (inode_write_at (dir->inode, sector, BLOCK_SECTOR_SIZE, sec_ofs)
+      == BLOCK_SECTOR_SIZE)
+    {
+      /* Remove inode. */
+      inode_remove (*inode);
+      success = true;
+    }
+  end_remove (*inode);
+
+ done:
+  free (sector);
+  return success;
+}
+
+/* Reads the next in-use record of variable-length DIR, other
+   than "." and "..", into NAME.  Records are located by byte
+   offset rather than by following DIR->pos directly, so a record
+   merged away since the last call cannot derail the scan. */
+static bool
+rec_readdir (struct dir *dir, char name[NAME_MAX + 1])
+{
+  uint8_t *sector;
+  off_t sec_ofs;
+  bool success = false;
+
+  sector = malloc (BLOCK_SECTOR_SIZE);
+  if (sector == NULL)
+    return false;
+
+  for (sec_ofs = ROUND_DOWN (dir->pos, BLOCK_SECTOR_SIZE);
+       !success && rec_read_sector (dir, sec_ofs, sector);
+       sec_ofs += BLOCK_SECTOR_SIZE)
+    {
+      struct dir_rec *r;
+
+      for (r = (struct dir_rec *) sector; r != NULL; r = rec_next (sector, r))
+        {
+          off_t rec_ofs = sec_ofs + ((uint8_t *) r - sector);
+          if (rec_ofs < dir->pos || r->inode_sector == 0)
+            continue;
+          dir->pos = rec_ofs + r->rec_len;
+          if ((r->name_len == 1 && r->name[0] == '.')
+              || (r->name_len == 2 && !memcmp (r->name, "..", 2)))
+            continue;
+          memcpy (name, r->name, r->name_len);
+          name[r->name_len] = '\0';
+          success = true;
+          break;
+        }
+      if (!success)
+        dir->pos = sec_ofs + BLOCK_SECTOR_SIZE;
+    }
+
+  free (sector);
+  return success;
+}
+
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
@@ -124,10 +415,23 @@ dir_lookup (const struct dir *dir, const char *name,
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
+  inode_lock_dir (dir->inode);
+  if (dir->format == DIR_FMT_VAR)
+    {
+      uint8_t *sector = malloc (BLOCK_SECTOR_SIZE);
+      struct dir_rec *r, *prev;
+      off_t sec_ofs;
+
+      *inode = NULL;
+      if (sector != NULL && rec_find (dir, name, sector, &sec_ofs, &r, &prev))
+        *inode = inode_open (r->inode_sector);
+      free (sector);
+    }
+  else if (lookup (dir, name, &e, NULL))
     *inode = inode_open (e.inode_sector);
   else
     *inode = NULL;
+  inode_unlock_dir (dir->inode);
 
   return *inode != NULL;
 }
@@ -152,6 +456,16 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
+  journal_begin ();
+  inode_lock_dir (dir->inode);
+  if (inode_is_removed (dir->inode))
+    goto done;
+  if (dir->format == DIR_FMT_VAR)
+    {
+      success = rec_add (dir, name, inode_sector);
+      goto done;
+    }
+
   /* Check that NAME is not in use. */
   if (lookup (dir, name, NULL, NULL))
     goto done;
@@ -175,6 +489,8 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 
  done:
+  inode_unlock_dir (dir->inode);
+  journal_end ();
   return success;
 }
 
@@ -195,26 +511,37 @@ dir_remove (struct dir *dir, const char *name)
   if (!strcmp(name, "."))	return false;
   if (!strcmp(name, ".."))	return false;
 
+  journal_begin ();
+  inode_lock_dir (dir->inode);
+  if (dir->format == DIR_FMT_VAR)
+    {
+      success = rec_remove (dir, name, &inode);
+      goto done;
+    }
+
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
     goto done;
 
   /* Open inode. */
   inode = inode_open (e.inode_sector);
-  if (inode == NULL)
+  if (inode == NULL || !begin_remove (inode))
     goto done;
 
   /* Erase directory entry. */
   e.in_use = false;
-  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
-    goto done;
-
-  /* Remove inode. */
-  inode_remove (inode);
-  success = true;
+  if (inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e)
+    {
+      /* Remove inode. */
+      inode_remove (inode);
+      success = true;
+    }
+  end_remove (inode);
 
  done:
+  inode_unlock_dir (dir->inode);
   inode_close (inode);
+  journal_end ();
   return success;
 }
 
@@ -225,15 +552,48 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  bool success = false;
+
+  inode_lock_dir (dir->inode);
+  if (dir->format == DIR_FMT_VAR)
+    success = rec_readdir (dir, name);
+  else
+    while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+      {
+        dir->pos += sizeof e;
+        if (e.in_use && strcmp(e.name, ".") && strcmp(e.name, ".."))
+          {
+            strlcpy (name, e.name, NAME_MAX + 1);
+            success = true;
+            break;
+          } 
+      }
+  inode_unlock_dir (dir->inode);
+  return success;
+}
+
+/* Returns true if the directory in INODE, whose lock the caller
+   holds, has no entries other than "." and "..". */
+static bool
+dir_is_empty (struct inode *inode)
+{
+  struct dir *dir = dir_open (inode_reopen (inode));
+  char name[NAME_MAX + 1];
+  struct dir_entry e;
+  bool empty = true;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
-    {
-      dir->pos += sizeof e;
-      if (e.in_use && strcmp(e.name, ".") && strcmp(e.name, ".."))
+  if (dir == NULL)
+    return false;
+  if (dir->format == DIR_FMT_VAR)
+    empty = !rec_readdir (dir, name);
+  else
+    for (; inode_read_at (inode, &e, sizeof e, dir->pos) == sizeof e;
+         dir->pos += sizeof e)
+      if (e.in_use && strcmp (e.name, ".") && strcmp (e.name, ".."))
         {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
-        } 
-    }
-  return false;
+          empty = false;
+          break;
+        }
+  dir_close (dir);
+  return empty;
 }
@@ -11,6 +11,22 @@
    retained, but much longer full path names must be allowed. */
 #define NAME_MAX 14
 
+/* Most journal credits that dir_add() spends. */
+#define DIR_ADD_CREDITS 8
+
+/* On-disk directory formats.  Each directory records its format
+   in its inode, so directories of both formats may coexist. */
+enum dir_format
+  {
+    DIR_FMT_FIXED = 1,          /* Array of fixed-size entries. */
+    DIR_FMT_VAR = 2             /* Variable-length records. */
+  };
+
+/* Format given to newly created directories.
+   Chosen by kernel command-line option "-dirfmt" when the file
+   system is formatted, otherwise taken from the root directory. */
+extern enum dir_format dir_format;
+
 struct inode;
 
 /* Opening and closing directories. */
@@ -20,6 +36,7 @@ struct dir *dir_open_root (void);
 struct dir *dir_reopen (struct dir *);
 void dir_close (struct dir *);
 struct inode *dir_get_inode (struct dir *);
+enum dir_format dir_get_format (struct dir *);
 
 /* Reading and writing. */
 bool dir_lookup (const struct dir *, const char *name, struct inode **);
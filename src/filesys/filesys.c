@@ -10,6 +10,7 @@
 #include "filesys/inode.h"
 #include "filesys/directory.h"
 #include "filesys/buffer_cache.h"
+#include "filesys/journal.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
@@ -28,6 +29,7 @@ filesys_init (bool format)
   bc_init();
   inode_init ();
   free_map_init ();
+  journal_init (format);
 
   if (format) 
     do_format ();
@@ -35,6 +37,8 @@ filesys_init (bool format)
   free_map_open ();
 
   thread_current()->cur_dir = dir_open_root();
+  if (!format)
+    dir_format = dir_get_format (thread_current()->cur_dir);
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -43,9 +47,19 @@ void
 filesys_done (void) 
 {
   free_map_close ();
+  journal_done ();
   bc_term();
 }
 
+/* Writes all of the file system's cached data to disk, committing
+   the journal first. */
+void
+filesys_sync (void)
+{
+  journal_commit ();
+  bc_flush_all_entries ();
+}
+
 /* Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
@@ -60,12 +74,19 @@ filesys_create (const char *name, off_t initial_size)
 
   block_sector_t inode_sector = 0;
   struct dir *dir = parse_path(prename, filename);
+  journal_begin ();
   bool success = (dir != NULL
                   && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size, 0)
-                  && dir_add (dir, filename, inode_sector));
+                  && inode_create (inode_sector, initial_size, 0));
+  if (success)
+    {
+      /* A large INITIAL_SIZE may have used up the credits. */
+      journal_restart (DIR_ADD_CREDITS);
+      success = dir_add (dir, filename, inode_sector);
+    }
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
+  journal_end ();
   palloc_free_page(prename);
   palloc_free_page(filename);
   dir_close (dir);
@@ -105,28 +126,16 @@ filesys_remove (const char *name)
 {
   if(name == NULL)	return false;
   bool success = false;
-  struct inode *inode;
 
   char *prename = palloc_get_page(0);
   char *filename = palloc_get_page(0);
 
   strlcpy(prename, name, PGSIZE);
   struct dir *dir = parse_path(prename, filename);
-  if(dir_lookup(dir, filename, &inode))
-  {
-  	if(!inode_is_dir(inode))
-	{
-		success = dir_remove(dir, filename);
-	}
-	else
-	{
-		struct dir *dir = dir_open(inode);
-		if(!dir_readdir(dir, filename))
-		{
-			success = dir_remove(dir, filename);
-		}
-	}
-  }
+  /* dir_remove() checks that a directory is empty while it holds
+     the lock, so nothing can be added to it in between. */
+  if(dir != NULL)
+	success = dir_remove(dir, filename);
 
   palloc_free_page(prename);
   palloc_free_page(filename);
@@ -198,6 +207,7 @@ bool filesys_create_dir(const char *name)
 
     block_sector_t inode_sector = 0;
 	struct dir *dir = parse_path(prename, filename);
+	journal_begin ();
 	bool success = (dir != NULL && free_map_allocate(1, &inode_sector) && dir_create(inode_sector, 16) && dir_add(dir, filename, inode_sector));
 
 	if(!success && inode_sector != 0)	free_map_release(inode_sector, 1);
@@ -209,6 +219,7 @@ bool filesys_create_dir(const char *name)
 		dir_add(newdir, "..", inode_get_inumber(dir_get_inode(dir)));
 		dir_close(newdir);
 	}
+	journal_end ();
 
 	dir_close(dir);
 	palloc_free_page(prename);
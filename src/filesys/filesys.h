@@ -8,11 +8,16 @@
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
 
+/* Sectors reserved for the metadata journal. */
+#define JOURNAL_SECTOR 2        /* Journal superblock sector. */
+#define JOURNAL_SIZE 128        /* Sectors in the journal region. */
+
 /* Block device that contains the file system. */
 struct block *fs_device;
 
 void filesys_init (bool format);
 void filesys_done (void);
+void filesys_sync (void);
 bool filesys_create (const char *name, off_t initial_size);
 struct file *filesys_open (const char *name);
 bool filesys_remove (const char *name);
@@ -2,11 +2,14 @@
 #include <list.h>
 #include <debug.h>
 #include <round.h>
+#include <stdlib.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "filesys/buffer_cache.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
@@ -14,6 +17,11 @@
 #define DIRECT_BLOCK_ENTRIES 123
 #define INDIRECT_BLOCK_ENTRIES 128
 
+/* Most journal credits that growing a file by one sector spends:
+   the new sector if it is metadata, two indirect blocks, a free
+   map sector for each of those three, and the inode. */
+#define GROW_CREDITS 7
+
 enum direct_t
 {
 	NORMAL_DIRECT,
@@ -64,25 +72,42 @@ struct inode
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
   	
-	struct lock extend_lock;
+	struct lock extend_lock;            /* Serializes reads and writes. */
+	struct lock dir_lock;               /* Serializes directory updates. */
   };
 
 static bool get_disk_inode(const struct inode *, struct inode_disk *);
 static void locate_byte (off_t, struct sector_location *);
 static bool register_sector(struct inode_disk *, block_sector_t, struct sector_location);
-static bool inode_update_file_length(struct inode_disk *, off_t, off_t);
-static void free_inode_sectors (struct inode_disk *);
+static bool inode_update_file_length(struct inode_disk *, off_t, off_t, bool);
+static void grow_step (struct inode_disk *, off_t, bool);
+static void free_inode_sectors (struct inode_disk *, bool);
+static void free_sector (block_sector_t, bool);
 static block_sector_t byte_to_sector(const struct inode_disk*, off_t pos);
 
+/* Returns true if the data of the inode in SECTOR, whose on-disk
+   inode is INODE_DISK, is file system metadata and so has to go
+   through the journal: the contents of directories and of the
+   free map file. */
+static inline bool
+inode_data_is_meta (const struct inode_disk *inode_disk, block_sector_t sector)
+{
+  return inode_disk->is_dir || sector == FREE_MAP_SECTOR;
+}
+
 /* List of open inodes, so that opening a single inode twice
    returns the same `struct inode'. */
 static struct list open_inodes;
 
+/* Protects open_inodes and the open_cnt of every inode in it. */
+static struct lock open_inodes_lock;
+
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
   list_init (&open_inodes);
+  lock_init (&open_inodes_lock);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -102,12 +127,13 @@ inode_create (block_sector_t sector, off_t length, uint32_t is_dir)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+  journal_begin ();
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
 	  memset(disk_inode, 0xFF, sizeof(*disk_inode));
      // size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
+      disk_inode->length = 0;
       disk_inode->magic = INODE_MAGIC;
      /* if (free_map_allocate (sectors, &disk_inode->start)) 
         {
@@ -123,14 +149,18 @@ inode_create (block_sector_t sector, off_t length, uint32_t is_dir)
           success = true; 
         } */
 	  disk_inode->is_dir = is_dir;
-	  if (length > 0)
+	  /* Nobody can see the inode yet, so the journal operation may
+	     be restarted between any two steps. */
+	  while (disk_inode->length < length)
 	  {
-	  		inode_update_file_length(disk_inode, 0, length - 1);
+	  		journal_restart(GROW_CREDITS);
+	  		grow_step(disk_inode, length, inode_data_is_meta(disk_inode, sector));
 	  }
-	  bc_write(sector, disk_inode, 0, BLOCK_SECTOR_SIZE, 0);
+	  bc_write_meta(sector, disk_inode, 0, BLOCK_SECTOR_SIZE, 0);
 	  success = true;
     }
     free (disk_inode);
+  journal_end ();
   return success;
 }
 
@@ -143,6 +173,8 @@ inode_open (block_sector_t sector)
   struct list_elem *e;
   struct inode *inode;
 
+  lock_acquire (&open_inodes_lock);
+
   /* Check whether this inode is already open. */
   for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
        e = list_next (e)) 
@@ -150,7 +182,8 @@ inode_open (block_sector_t sector)
       inode = list_entry (e, struct inode, elem);
       if (inode->sector == sector) 
         {
-          inode_reopen (inode);
+          inode->open_cnt++;
+          lock_release (&open_inodes_lock);
           return inode; 
         }
     }
@@ -158,7 +191,10 @@ inode_open (block_sector_t sector)
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
   /* Initialize. */
   list_push_front (&open_inodes, &inode->elem);
@@ -167,7 +203,9 @@ inode_open (block_sector_t sector)
   inode->deny_write_cnt = 0;
   inode->removed = false;
   lock_init(&inode->extend_lock);
+  lock_init(&inode->dir_lock);
   //block_read (fs_device, inode->sector, &inode->data);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -176,7 +214,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -198,22 +240,29 @@ inode_close (struct inode *inode)
     return;
 
   /* Release resources if this was the last opener. */
+  lock_acquire (&open_inodes_lock);
   if (--inode->open_cnt == 0)
     {
       /* Remove from inode list and release lock. */
       list_remove (&inode->elem);
+      lock_release (&open_inodes_lock);
  
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
           struct inode_disk inode_disk;
+		  journal_begin ();
 		  get_disk_inode(inode, &inode_disk);
-		  free_inode_sectors(&inode_disk);
-		  free_map_release(inode->sector, 1);
+		  free_inode_sectors(&inode_disk,
+		                     inode_data_is_meta(&inode_disk, inode->sector));
+		  free_sector(inode->sector, true);
+		  journal_end ();
         }
 
       free (inode); 
     }
+  else
+    lock_release (&open_inodes_lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -225,6 +274,13 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Returns true if INODE has been marked for removal. */
+bool
+inode_is_removed (const struct inode *inode)
+{
+  return inode->removed;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
@@ -277,7 +333,8 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
           memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
         }*/
 
-	  bc_read (sector_idx, (void*)buffer, bytes_read, chunk_size, sector_ofs);
+	  if (!bc_read (sector_idx, (void*)buffer, bytes_read, chunk_size, sector_ofs))
+	  	break;
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
@@ -285,8 +342,6 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
     }
   free (bounce);
 
-  bc_write(inode->sector, &inode_disk, 0, BLOCK_SECTOR_SIZE, 0);
-
   lock_release(&inode->extend_lock);
 
   return bytes_read;
@@ -305,21 +360,46 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
   off_t bytes_written = 0;
   uint8_t *bounce = NULL;
   struct inode_disk inode_disk;
+  bool meta, journaled;
 
-  inode_disk.length = 0;
+  /* Only writes that may touch metadata join the journal, so that
+     overwriting file data never waits for a commit.  The length
+     only grows, so a write found not to extend the file here
+     cannot extend it below. */
+  get_disk_inode(inode, &inode_disk);
+  journaled = (inode_data_is_meta(&inode_disk, inode->sector)
+               || offset + size > inode_disk.length);
+  if (journaled)
+    journal_begin ();
+  lock_acquire(&inode->extend_lock);
 
   if (inode->deny_write_cnt)
-    return 0;
-
-  lock_acquire(&inode->extend_lock);
+    {
+      lock_release(&inode->extend_lock);
+      if (journaled)
+        journal_end ();
+      return 0;
+    }
 
   get_disk_inode(inode, &inode_disk);
-  int old_length = inode_disk.length;
-  int write_end =  offset + size - 1;
-  if(write_end > old_length - 1)
+  meta = inode_data_is_meta(&inode_disk, inode->sector);
+
+  /* Grow the file a sector at a time.  The inode is consistent
+     after every step, so a large write may restart its journal
+     operation in between, with EXTEND_LOCK released.  Metadata
+     files only grow by a sector or so, from callers that may hold
+     other locks, and never get that far. */
+  while (offset + size > inode_disk.length)
   {
-  	inode_update_file_length(&inode_disk, old_length, write_end);
-	bc_write(inode->sector, &inode_disk, 0, BLOCK_SECTOR_SIZE, 0);
+	grow_step(&inode_disk, offset + size, meta);
+	bc_write_meta(inode->sector, &inode_disk, 0, BLOCK_SECTOR_SIZE, 0);
+	if (offset + size > inode_disk.length)
+	{
+		lock_release(&inode->extend_lock);
+		journal_restart(GROW_CREDITS);
+		lock_acquire(&inode->extend_lock);
+		get_disk_inode(inode, &inode_disk);
+	}
   }
 
   while (size > 0) 
@@ -368,7 +448,9 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       }*/
 
 	  
-	  	bc_write (sector_idx, (void*)buffer, bytes_written, chunk_size, sector_ofs);
+	  if (meta ? !bc_write_meta (sector_idx, (void*)buffer, bytes_written, chunk_size, sector_ofs)
+	           : !bc_write (sector_idx, (void*)buffer, bytes_written, chunk_size, sector_ofs))
+	  	break;
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
@@ -376,6 +458,8 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
     }
   free (bounce);
   lock_release(&inode->extend_lock);
+  if (journaled)
+    journal_end ();
 
   return bytes_written;
 }
@@ -385,8 +469,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  lock_acquire (&inode->extend_lock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  lock_release (&inode->extend_lock);
 }
 
 /* Re-enables writes to INODE.
@@ -395,9 +481,109 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  lock_acquire (&inode->extend_lock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  lock_release (&inode->extend_lock);
+}
+
+/* Acquires INODE's directory lock, which callers in directory.c
+   hold across a lookup and the update that depends on it.  This
+   is separate from the lock taken by inode_read_at() and
+   inode_write_at(), so those may be called while holding it. */
+void
+inode_lock_dir (struct inode *inode)
+{
+  lock_acquire (&inode->dir_lock);
+}
+
+/* Releases INODE's directory lock. */
+void
+inode_unlock_dir (struct inode *inode)
+{
+  lock_release (&inode->dir_lock);
+}
+
+/* Set of dirty buffer cache sectors, for inode_flush(). */
+struct dirty_set
+  {
+    block_sector_t sectors[BUFFER_CACHE_ENTRY_NB];  /* Ascending. */
+    bool owned[BUFFER_CACHE_ENTRY_NB];  /* Belongs to the inode? */
+    size_t cnt;
+  };
+
+/* Marks SECTOR as owned if it is in SET. */
+static void
+dirty_set_mark (struct dirty_set *set, block_sector_t sector)
+{
+  block_sector_t *p = bsearch (&sector, set->sectors, set->cnt,
+                               sizeof *set->sectors, compare_sectors);
+  if (p != NULL)
+    set->owned[p - set->sectors] = true;
+}
+
+/* Marks each sector of the indirect block in SECTOR, and the
+   block itself, as owned.  If LEVELS is 2, SECTOR is a double
+   indirect block and the marking recurses. */
+static void
+dirty_set_mark_indirect (struct dirty_set *set, block_sector_t sector,
+                         int levels)
+{
+  struct inode_indirect_block block;
+  int i;
+
+  dirty_set_mark (set, sector);
+  bc_read (sector, &block, 0, sizeof block, 0);
+  for (i = 0; i < INDIRECT_BLOCK_ENTRIES; i++)
+    {
+      if (block.map_table[i] == (block_sector_t) -1)
+        break;
+      if (levels > 1)
+        dirty_set_mark_indirect (set, block.map_table[i], levels - 1);
+      else
+        dirty_set_mark (set, block.map_table[i]);
+    }
+}
+
+/* Writes every dirty cached sector of INODE, that is its data,
+   its indirect blocks and its inode sector, to disk in ascending
+   sector order.  The running journal transaction is committed
+   first, so that the metadata leading to INODE is durable too. */
+void
+inode_flush (struct inode *inode)
+{
+  struct dirty_set *set;
+  struct inode_disk inode_disk;
+  size_t i;
+
+  journal_commit ();
+
+  set = calloc (1, sizeof *set);
+  if (set == NULL)
+    return;
+
+  lock_acquire (&inode->extend_lock);
+  set->cnt = bc_dirty_sectors (set->sectors);
+  get_disk_inode (inode, &inode_disk);
+  dirty_set_mark (set, inode->sector);
+  for (i = 0; i < DIRECT_BLOCK_ENTRIES; i++)
+    {
+      if (inode_disk.direct_map_table[i] == (block_sector_t) -1)
+        break;
+      dirty_set_mark (set, inode_disk.direct_map_table[i]);
+    }
+  if (inode_disk.indirect_block_sec != (block_sector_t) -1)
+    dirty_set_mark_indirect (set, inode_disk.indirect_block_sec, 1);
+  if (inode_disk.double_indirect_block_sec != (block_sector_t) -1)
+    dirty_set_mark_indirect (set, inode_disk.double_indirect_block_sec, 2);
+
+  for (i = 0; i < set->cnt; i++)
+    if (set->owned[i])
+      bc_flush_sector (set->sectors[i]);
+  lock_release (&inode->extend_lock);
+
+  free (set);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -459,7 +645,7 @@ static bool register_sector (struct inode_disk *inode_disk, block_sector_t new_s
 			}
 			bc_read(inode_disk->indirect_block_sec, &first_block, 0, sizeof(struct inode_indirect_block), 0);
 			first_block.map_table[sec_loc.index1] = new_sector;
-			bc_write(inode_disk->indirect_block_sec, &first_block, 0, sizeof(struct inode_indirect_block), 0);
+			bc_write_meta(inode_disk->indirect_block_sec, &first_block, 0, sizeof(struct inode_indirect_block), 0);
 			break;
 		case DOUBLE_INDIRECT:
 			if(inode_disk->double_indirect_block_sec == -1)
@@ -471,12 +657,12 @@ static bool register_sector (struct inode_disk *inode_disk, block_sector_t new_s
 			if(first_block.map_table[sec_loc.index1] == -1)
 			{
 				if(!free_map_allocate(1, &first_block.map_table[sec_loc.index1])) return false;
-				bc_write(inode_disk->double_indirect_block_sec, &first_block, 0, sizeof(struct inode_indirect_block), 0);
+				bc_write_meta(inode_disk->double_indirect_block_sec, &first_block, 0, sizeof(struct inode_indirect_block), 0);
 				memset(&second_block, 0xFF, sizeof(struct inode_indirect_block));
 			}
 			bc_read(first_block.map_table[sec_loc.index1], &second_block, 0, sizeof(struct inode_indirect_block), 0);
 			second_block.map_table[sec_loc.index2] = new_sector;
-			bc_write(first_block.map_table[sec_loc.index1], &second_block, 0, sizeof(struct inode_indirect_block), 0);
+			bc_write_meta(first_block.map_table[sec_loc.index1], &second_block, 0, sizeof(struct inode_indirect_block), 0);
 			break;
 		default:
 			return false;
@@ -513,7 +699,10 @@ static block_sector_t byte_to_sector(const struct inode_disk *inode_disk, off_t
 	}
 }
 
-bool inode_update_file_length(struct inode_disk *inode_disk, off_t start_pos, off_t end_pos)
+/* Grows INODE_DISK to END_POS + 1 bytes, allocating zeroed
+   sectors from START_POS on.  If META, the new sectors hold
+   metadata and are zeroed through the journal. */
+bool inode_update_file_length(struct inode_disk *inode_disk, off_t start_pos, off_t end_pos, bool meta)
 {
 	char *zeros = calloc(BLOCK_SECTOR_SIZE, sizeof(char));
 	off_t size = end_pos - start_pos + 1;
@@ -535,7 +724,10 @@ bool inode_update_file_length(struct inode_disk *inode_disk, off_t start_pos, of
 			}
 			locate_byte(offset, &sec_loc);
 			register_sector(inode_disk, sector, sec_loc);
-			bc_write(sector, zeros, 0, BLOCK_SECTOR_SIZE, 0);
+			if (meta)
+				bc_write_meta(sector, zeros, 0, BLOCK_SECTOR_SIZE, 0);
+			else
+				bc_write(sector, zeros, 0, BLOCK_SECTOR_SIZE, 0);
 		}
 		size -= chunk_size;
 		offset += chunk_size;
@@ -545,14 +737,38 @@ bool inode_update_file_length(struct inode_disk *inode_disk, off_t start_pos, of
 	return true;
 }
 
-static void free_inode_sectors(struct inode_disk *inode_disk)
+/* Grows INODE_DISK toward LENGTH bytes by at most one new
+   sector, which spends at most GROW_CREDITS journal credits. */
+static void grow_step(struct inode_disk *inode_disk, off_t length, bool meta)
+{
+	off_t end = ROUND_UP(inode_disk->length + 1, BLOCK_SECTOR_SIZE);
+
+	if (end > length)
+		end = length;
+	inode_update_file_length(inode_disk, inode_disk->length, end - 1, meta);
+}
+
+/* Frees SECTOR, revoking it from the journal if it held metadata.
+   Each sector is freed by its own step of the journal operation,
+   so that freeing a large file never runs out of credits. */
+static void free_sector(block_sector_t sector, bool meta)
+{
+	journal_restart(2);
+	if (meta)
+		journal_revoke(sector);
+	free_map_release(sector, 1);
+}
+
+/* Frees the sectors of INODE_DISK.  If META, its data sectors
+   hold metadata. */
+static void free_inode_sectors(struct inode_disk *inode_disk, bool meta)
 {
 	int i, j;
 	struct inode_indirect_block first_block, second_block; 
 	for(i = 0; i < DIRECT_BLOCK_ENTRIES; i++)
 	{
 		if (inode_disk->direct_map_table[i] == -1)	break;
-		free_map_release(inode_disk->direct_map_table[i], 1);
+		free_sector(inode_disk->direct_map_table[i], meta);
 	}
 	
 	if (inode_disk->indirect_block_sec != -1)
@@ -561,9 +777,9 @@ static void free_inode_sectors(struct inode_disk *inode_disk)
 		for(i = 0; i < INDIRECT_BLOCK_ENTRIES; i++)
 		{
 			if (first_block.map_table[i] == -1) break;
-			free_map_release(first_block.map_table[i], 1);
+			free_sector(first_block.map_table[i], meta);
 		}
-		free_map_release(inode_disk->indirect_block_sec, 1);
+		free_sector(inode_disk->indirect_block_sec, true);
 	}
 
 	if (inode_disk->double_indirect_block_sec != -1)
@@ -576,11 +792,11 @@ static void free_inode_sectors(struct inode_disk *inode_disk)
 			for(j = 0; j < INDIRECT_BLOCK_ENTRIES; j++)
 			{
 				if (second_block.map_table[j] == -1)	break;
-				free_map_release(second_block.map_table[j], 1);
+				free_sector(second_block.map_table[j], meta);
 			}
-			free_map_release(first_block.map_table[i], 1);
+			free_sector(first_block.map_table[i], true);
 		}
-		free_map_release(inode_disk->double_indirect_block_sec, 1);
+		free_sector(inode_disk->double_indirect_block_sec, true);
 	}
 }
 
@@ -591,3 +807,13 @@ bool inode_is_dir(const struct inode *inode)
 	get_disk_inode(inode, &inode_disk);
 	return inode_disk.is_dir;
 }
+
+/* Returns the directory format recorded in INODE, or 0 if INODE
+   is an ordinary file. */
+uint32_t inode_dir_format(const struct inode *inode)
+{
+	struct inode_disk inode_disk;
+
+	get_disk_inode(inode, &inode_disk);
+	return inode_disk.is_dir;
+}
@@ -0,0 +1,553 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/buffer_cache.h"
+#include "filesys/filesys.h"
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Write-ahead journal for file system metadata.
+
+   Every operation that updates metadata (inode sectors, indirect
+   blocks, directory contents and the free map) brackets its
+   updates with journal_begin() and journal_end().  Buffers that
+   such an operation writes with bc_write_meta() join the running
+   transaction and are pinned in the buffer cache, so that they
+   cannot reach their home sectors ahead of the journal.
+
+   An operation reserves JOURNAL_CREDITS credits when it begins and
+   spends one for each buffer it adds and each sector it revokes,
+   so a transaction can never outgrow TXN_MAX.  journal_begin()
+   waits until the running transaction has room for the credits.
+   An operation that may need more, such as growing a file by many
+   sectors, calls journal_restart() between steps that each leave
+   the file system consistent.
+
+   A metadata sector that is freed is revoked: it is listed in the
+   descriptor of the running transaction, and replay does not copy
+   it from that or any earlier transaction, whose image would
+   overwrite whatever the sector has been reused for since.
+
+   Operations from any number of threads accumulate in the same
+   transaction.  Once no operation is in progress, the transaction
+   is committed with one sequential run of writes: a descriptor
+   sector listing the home and revoked sectors, the buffer images,
+   then a
+   commit sector.  This happens when the transaction grows past
+   TXN_COMMIT_CNT buffers, every JOURNAL_COMMIT_TICKS ticks, and
+   at shutdown.  Committed buffers are simply left dirty in the
+   cache and reach their home sectors when they are evicted.
+   When the journal region runs short of space, every dirty buffer
+   is written home and the journal starts over (a checkpoint).
+
+   When a file system is mounted, committed transactions found
+   after the last checkpoint are copied to their home sectors. */
+
+/* Identifies the journal superblock. */
+#define JOURNAL_MAGIC 0x4a524e4c
+
+/* Identify descriptor and commit sectors. */
+#define DESC_MAGIC 0x4a444553
+#define COMMIT_MAGIC 0x4a434d54
+
+/* Maximum number of buffers, and of revoked sectors, in a
+   transaction.  This bounds the buffers pinned in the cache, which
+   must leave room for a batch of write-backs and a sequential fill
+   besides (see journal_init()). */
+#define TXN_MAX 32
+
+/* Commit once the running transaction holds this many buffers. */
+#define TXN_COMMIT_CNT 16
+
+/* Ticks between commits of a transaction that stays small. */
+#define JOURNAL_COMMIT_TICKS (5 * TIMER_FREQ)
+
+/* Journal superblock, in sector JOURNAL_SECTOR.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_super
+  {
+    unsigned magic;                     /* JOURNAL_MAGIC. */
+    uint32_t seq;                       /* Sequence of first transaction. */
+    uint32_t start;                     /* Offset of first transaction. */
+    uint8_t unused[500];                /* Not used. */
+  };
+
+/* Descriptor or commit sector of a transaction.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_header
+  {
+    unsigned magic;                     /* DESC_MAGIC or COMMIT_MAGIC. */
+    uint32_t seq;                       /* Transaction sequence number. */
+    uint32_t cnt;                       /* Number of buffers. */
+    uint32_t revoke_cnt;                /* Number of revoked sectors. */
+    block_sector_t home[TXN_MAX];       /* Home sector of each buffer. */
+    block_sector_t revoke[TXN_MAX];     /* Revoked sectors. */
+    uint8_t unused[496 - 2 * TXN_MAX * sizeof (block_sector_t)];
+  };
+
+/* A sector revoked by transaction SEQ, found during replay. */
+struct revoke_record
+  {
+    block_sector_t sector;
+    uint32_t seq;
+  };
+
+/* False if the file system has no journal. */
+static bool enabled;
+
+static struct lock journal_lock;        /* Protects all below. */
+static struct condition journal_cond;   /* Signaled when an operation
+                                           ends or a commit ends. */
+static int handles;                     /* Operations in progress. */
+static int reserved;                    /* Credits they have not spent. */
+static bool committing;                 /* A commit is waiting or running. */
+
+static struct buffer_head *txn[TXN_MAX];  /* Running transaction. */
+static size_t txn_cnt;                  /* Number of buffers in TXN. */
+static block_sector_t revoked[TXN_MAX]; /* Revoked by TXN. */
+static size_t revoke_cnt;               /* Number of sectors in REVOKED. */
+static uint32_t txn_seq;                /* Sequence number of TXN. */
+static uint32_t head;                   /* Offset of next free sector. */
+
+/* Room for a descriptor and TXN_MAX images, so that they can be
+   written or read with one disk command. */
+static uint8_t *txn_buf;
+
+static void replay (void);
+static bool has_room (void);
+static void commit (void);
+static void checkpoint (void);
+static void write_super (void);
+static thread_func journal_thread NO_RETURN;
+
+/* Initializes the journal.  If FORMAT is true, creates an empty
+   journal; otherwise replays the one found on disk. */
+void
+journal_init (bool format)
+{
+  ASSERT (sizeof (struct journal_super) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct journal_header) == BLOCK_SECTOR_SIZE);
+  ASSERT (JOURNAL_CREDITS <= TXN_MAX);
+  ASSERT (TXN_MAX + BC_FLUSH_BATCH + BC_FILL_MAX < BUFFER_CACHE_ENTRY_NB);
+
+  lock_init (&journal_lock);
+  cond_init (&journal_cond);
+  txn_buf = malloc ((TXN_MAX + 1) * BLOCK_SECTOR_SIZE);
+  if (txn_buf == NULL)
+    PANIC ("can't allocate journal buffer");
+
+  if (format)
+    {
+      txn_seq = 1;
+      write_super ();
+    }
+  else
+    {
+      struct journal_super *super = malloc (sizeof *super);
+      if (super == NULL)
+        PANIC ("can't allocate journal superblock");
+      block_read (fs_device, JOURNAL_SECTOR, super);
+      if (super->magic != JOURNAL_MAGIC)
+        {
+          printf ("journal: none found, metadata journaling disabled\n");
+          free (super);
+          free (txn_buf);
+          return;
+        }
+      txn_seq = super->seq;
+      head = super->start;
+      free (super);
+      replay ();
+    }
+
+  enabled = true;
+  thread_create ("journal", PRI_DEFAULT, journal_thread, NULL);
+}
+
+/* Commits the running transaction and checkpoints the journal, so
+   that the file system can be mounted without replay. */
+void
+journal_done (void)
+{
+  if (!enabled)
+    return;
+
+  lock_acquire (&journal_lock);
+  commit ();
+  checkpoint ();
+  lock_release (&journal_lock);
+}
+
+/* Starts a file system operation whose metadata updates must
+   reach the disk together, reserving JOURNAL_CREDITS credits for
+   it.  Calls nest; only the outermost one counts.  Must be called
+   before acquiring any file system lock, because it may wait for
+   a commit to finish. */
+void
+journal_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  if (!enabled || t->journal_depth++ > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  while (committing)
+    cond_wait (&journal_cond, &journal_lock);
+  if (txn_cnt >= TXN_COMMIT_CNT)
+    commit ();
+  while (!has_room ())
+    {
+      /* Operations in progress give back what they do not spend
+         when they end; once none is left, commit. */
+      if (handles == 0 && !committing)
+        commit ();
+      else
+        cond_wait (&journal_cond, &journal_lock);
+    }
+  handles++;
+  reserved += JOURNAL_CREDITS;
+  t->journal_credits = JOURNAL_CREDITS;
+  lock_release (&journal_lock);
+}
+
+/* Returns true if the running transaction can take a new
+   operation's credits.  Must be called with JOURNAL_LOCK held. */
+static bool
+has_room (void)
+{
+  return (!committing
+          && txn_cnt + reserved + JOURNAL_CREDITS <= TXN_MAX
+          && revoke_cnt + reserved + JOURNAL_CREDITS <= TXN_MAX);
+}
+
+/* Ends the operation started by the matching journal_begin().
+   Must be called after releasing every file system lock. */
+void
+journal_end (void)
+{
+  if (!enabled)
+    return;
+
+  ASSERT (thread_current ()->journal_depth > 0);
+  if (--thread_current ()->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  handles--;
+  reserved -= thread_current ()->journal_credits;
+  thread_current ()->journal_credits = 0;
+  if (committing || txn_cnt < TXN_COMMIT_CNT)
+    cond_broadcast (&journal_cond, &journal_lock);
+  else
+    commit ();
+  lock_release (&journal_lock);
+}
+
+/* Makes sure that the running operation has at least CREDITS
+   credits left, if need be by ending its handle and starting a
+   new one, which may commit what it did so far.  The caller must
+   hold no file system lock and must have left the file system
+   consistent, because a crash may now take effect between the two
+   halves of the operation. */
+void
+journal_restart (int credits)
+{
+  struct thread *t = thread_current ();
+  int depth;
+
+  ASSERT (credits <= JOURNAL_CREDITS);
+  if (!enabled || t->journal_credits >= credits)
+    return;
+
+  ASSERT (t->journal_depth > 0);
+  depth = t->journal_depth;
+  t->journal_depth = 1;
+  journal_end ();
+  journal_begin ();
+  t->journal_depth = depth;
+}
+
+/* Takes one of the running operation's credits.  Must be called
+   with JOURNAL_LOCK held. */
+static void
+spend_credit (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->journal_depth > 0);
+  ASSERT (t->journal_credits > 0);
+  t->journal_credits--;
+  reserved--;
+}
+
+/* Adds BH, which the caller has locked and modified, to the
+   running transaction.  The caller must be inside
+   journal_begin(). */
+void
+journal_add (struct buffer_head *bh)
+{
+  size_t i;
+
+  if (!enabled)
+    return;
+
+  ASSERT (!bh->journaled);
+
+  lock_acquire (&journal_lock);
+  spend_credit ();
+  txn[txn_cnt++] = bh;
+  bh->journaled = true;
+
+  /* The sector was freed and reused as metadata by this same
+     transaction, so its new image must be replayed. */
+  for (i = 0; i < revoke_cnt; i++)
+    if (revoked[i] == bh->sector)
+      {
+        revoked[i] = revoked[--revoke_cnt];
+        break;
+      }
+  lock_release (&journal_lock);
+}
+
+/* Revokes SECTOR, a metadata sector that the running operation
+   is freeing, so that replay does not overwrite it with an image
+   from this or an earlier transaction.  The caller must be inside
+   journal_begin(). */
+void
+journal_revoke (block_sector_t sector)
+{
+  size_t i;
+
+  if (!enabled)
+    return;
+
+  lock_acquire (&journal_lock);
+  for (i = 0; i < revoke_cnt; i++)
+    if (revoked[i] == sector)
+      break;
+  if (i == revoke_cnt)
+    {
+      spend_credit ();
+      revoked[revoke_cnt++] = sector;
+    }
+  lock_release (&journal_lock);
+}
+
+/* Commits the running transaction. */
+void
+journal_commit (void)
+{
+  if (!enabled)
+    return;
+
+  lock_acquire (&journal_lock);
+  commit ();
+  lock_release (&journal_lock);
+}
+
+/* Waits for operations in progress to finish, then writes the
+   running transaction to the journal and unpins its buffers.
+   Must be called with JOURNAL_LOCK held. */
+static void
+commit (void)
+{
+  struct journal_header *hdr;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+
+  if (committing)
+    {
+      /* Another thread is committing; let it finish. */
+      while (committing)
+        cond_wait (&journal_cond, &journal_lock);
+      return;
+    }
+
+  committing = true;
+  while (handles > 0)
+    cond_wait (&journal_cond, &journal_lock);
+
+  if (txn_cnt > 0 || revoke_cnt > 0)
+    {
+      ASSERT (head + txn_cnt + 2 <= JOURNAL_SIZE);
+
+      hdr = calloc (1, sizeof *hdr);
+      if (hdr == NULL)
+        PANIC ("can't allocate journal header");
+      hdr->magic = DESC_MAGIC;
+      hdr->seq = txn_seq;
+      hdr->cnt = txn_cnt;
+      hdr->revoke_cnt = revoke_cnt;
+      for (i = 0; i < txn_cnt; i++)
+        hdr->home[i] = txn[i]->sector;
+      memcpy (hdr->revoke, revoked, revoke_cnt * sizeof *revoked);
+
+      /* No operation is in progress, so nobody modifies the
+         buffers while they are copied.  The commit sector goes
+         out only after the rest has reached the disk. */
+      memcpy (txn_buf, hdr, BLOCK_SECTOR_SIZE);
+      for (i = 0; i < txn_cnt; i++)
+        memcpy (txn_buf + (i + 1) * BLOCK_SECTOR_SIZE, txn[i]->buffer,
+                BLOCK_SECTOR_SIZE);
+      block_write_multiple (fs_device, JOURNAL_SECTOR + head, txn_cnt + 1,
+                            txn_buf);
+      hdr->magic = COMMIT_MAGIC;
+      block_write (fs_device, JOURNAL_SECTOR + head + 1 + txn_cnt, hdr);
+      free (hdr);
+
+      for (i = 0; i < txn_cnt; i++)
+        bc_unpin (txn[i]);
+      head += txn_cnt + 2;
+      txn_seq++;
+      txn_cnt = 0;
+      revoke_cnt = 0;
+
+      /* Make room for a transaction of the largest size. */
+      if (head + TXN_MAX + 2 > JOURNAL_SIZE)
+        checkpoint ();
+    }
+
+  committing = false;
+  cond_broadcast (&journal_cond, &journal_lock);
+}
+
+/* Writes every dirty buffer to its home sector and empties the
+   journal.  Must be called with JOURNAL_LOCK held and no buffer
+   pinned. */
+static void
+checkpoint (void)
+{
+  ASSERT (txn_cnt == 0 && revoke_cnt == 0);
+
+  bc_flush_all_entries ();
+  write_super ();
+}
+
+/* Writes a superblock describing an empty journal whose next
+   transaction is TXN_SEQ. */
+static void
+write_super (void)
+{
+  struct journal_super *super = calloc (1, sizeof *super);
+  if (super == NULL)
+    PANIC ("can't allocate journal superblock");
+  super->magic = JOURNAL_MAGIC;
+  super->seq = txn_seq;
+  super->start = 1;
+  block_write (fs_device, JOURNAL_SECTOR, super);
+  free (super);
+  head = 1;
+}
+
+/* Reads the descriptor of the transaction at offset OFS into
+   DESC, using CMT as scratch, and returns true if it is a
+   committed transaction with sequence number SEQ. */
+static bool
+read_txn (uint32_t ofs, uint32_t seq, struct journal_header *desc,
+          struct journal_header *cmt)
+{
+  if (ofs + 2 > JOURNAL_SIZE)
+    return false;
+  block_read (fs_device, JOURNAL_SECTOR + ofs, desc);
+  if (desc->magic != DESC_MAGIC || desc->seq != seq
+      || desc->cnt > TXN_MAX || desc->revoke_cnt > TXN_MAX
+      || ofs + desc->cnt + 2 > JOURNAL_SIZE)
+    return false;
+  block_read (fs_device, JOURNAL_SECTOR + ofs + 1 + desc->cnt, cmt);
+  return (cmt->magic == COMMIT_MAGIC && cmt->seq == seq
+          && cmt->cnt == desc->cnt && cmt->revoke_cnt == desc->revoke_cnt);
+}
+
+/* Returns true if one of the CNT records in REVOKES revokes
+   SECTOR as of transaction SEQ or later. */
+static bool
+is_revoked (const struct revoke_record *revokes, size_t cnt,
+            block_sector_t sector, uint32_t seq)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    if (revokes[i].sector == sector && revokes[i].seq >= seq)
+      return true;
+  return false;
+}
+
+/* Copies each committed transaction, starting at HEAD with
+   sequence number TXN_SEQ, to its home sectors, then empties the
+   journal.  A transaction without a matching commit sector was
+   interrupted and is ignored, along with anything after it.
+   A first pass gathers the revoked sectors, so that the second
+   skips every image that a revocation in the same or a later
+   transaction makes stale. */
+static void
+replay (void)
+{
+  struct journal_header *desc, *cmt;
+  struct revoke_record *revokes = NULL;
+  size_t revoke_total = 0;
+  uint32_t ofs, seq;
+  int replayed = 0;
+  uint32_t i;
+
+  desc = malloc (sizeof *desc);
+  cmt = malloc (sizeof *cmt);
+  if (desc == NULL || cmt == NULL)
+    PANIC ("can't allocate journal replay buffers");
+
+  for (ofs = head, seq = txn_seq; read_txn (ofs, seq, desc, cmt);
+       ofs += desc->cnt + 2, seq++)
+    if (desc->revoke_cnt > 0)
+      {
+        revokes = realloc (revokes, (revoke_total + desc->revoke_cnt)
+                                    * sizeof *revokes);
+        if (revokes == NULL)
+          PANIC ("can't allocate journal revoke table");
+        for (i = 0; i < desc->revoke_cnt; i++)
+          {
+            revokes[revoke_total].sector = desc->revoke[i];
+            revokes[revoke_total].seq = seq;
+            revoke_total++;
+          }
+      }
+
+  while (read_txn (head, txn_seq, desc, cmt))
+    {
+      block_read_multiple (fs_device, JOURNAL_SECTOR + head + 1, desc->cnt,
+                           txn_buf);
+      for (i = 0; i < desc->cnt; i++)
+        if (!is_revoked (revokes, revoke_total, desc->home[i], txn_seq))
+          block_write (fs_device, desc->home[i],
+                       txn_buf + i * BLOCK_SECTOR_SIZE);
+      head += desc->cnt + 2;
+      txn_seq++;
+      replayed++;
+    }
+
+  if (replayed > 0)
+    printf ("journal: replayed %d transactions\n", replayed);
+  write_super ();
+
+  free (revokes);
+  free (cmt);
+  free (desc);
+}
+
+/* Commits the running transaction periodically, so that a
+   trickle of small operations still reaches the disk. */
+static void
+journal_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (JOURNAL_COMMIT_TICKS);
+      lock_acquire (&journal_lock);
+      if ((txn_cnt > 0 || revoke_cnt > 0) && !committing)
+        commit ();
+      lock_release (&journal_lock);
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Credits each operation reserves in journal_begin().  An
+   operation spends one for each buffer it adds to the running
+   transaction and each sector it revokes. */
+#define JOURNAL_CREDITS 16
+
+struct buffer_head;
+
+void journal_init (bool format);
+void journal_done (void);
+
+void journal_begin (void);
+void journal_end (void);
+void journal_restart (int credits);
+void journal_add (struct buffer_head *);
+void journal_revoke (block_sector_t);
+void journal_commit (void);
+
+#endif /* filesys/journal.h */
@@ -0,0 +1,29 @@
+#ifndef __LIB_BLOCKSTATS_H
+#define __LIB_BLOCKSTATS_H
+
+#include <stdint.h>
+
+/* Number of histogram buckets.  Bucket 0 counts times under 2
+   cycles, bucket I > 0 times in [2**I, 2**(I+1)) cycles, and the
+   last bucket everything longer. */
+#define BLOCKSTATS_BUCKETS 40
+
+/* Block device statistics reported by the blockstats system
+   call.  Times are in CPU cycles. */
+struct blockstats
+  {
+    uint64_t read_cnt;                  /* Sectors read. */
+    uint64_t write_cnt;                 /* Sectors written. */
+    uint64_t cycles_per_tick;           /* CPU cycles per timer tick. */
+
+    /* Driver transfers by time taken. */
+    uint32_t read_hist[BLOCKSTATS_BUCKETS];
+    uint32_t write_hist[BLOCKSTATS_BUCKETS];
+
+    /* Requests by time spent queued for the device. */
+    uint32_t wait_hist[BLOCKSTATS_BUCKETS];
+    uint64_t wait_cycles;               /* Total time queued. */
+    uint32_t max_waiters;               /* Most requests queued at once. */
+  };
+
+#endif /* lib/blockstats.h */
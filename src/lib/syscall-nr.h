@@ -28,7 +28,19 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+    SYS_FSYNC,                  /* Writes a file's cached blocks to disk. */
+    SYS_SYNC,                   /* Writes all cached blocks to disk. */
+
+    /* Measurement. */
+    SYS_SYSSTATS,               /* Reports system statistics. */
+    SYS_BLOCKSTATS,             /* Reports block device statistics. */
+
+    /* Process creation. */
+    SYS_FORK,                   /* Duplicates the calling process. */
+
+    /* Memory mapping. */
+    SYS_MSYNC                   /* Writes back a memory mapping. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -0,0 +1,17 @@
+#ifndef __LIB_SYSSTATS_H
+#define __LIB_SYSSTATS_H
+
+#include <stdint.h>
+
+/* System statistics reported by the sysstats system call. */
+struct sysstats
+  {
+    int64_t ticks;                      /* Timer ticks since boot. */
+    int timer_freq;                     /* Timer ticks per second. */
+    uint64_t fs_reads;                  /* Sectors read from file system. */
+    uint64_t fs_writes;                 /* Sectors written to file system. */
+    unsigned user_pages;                /* Pages in the user pool. */
+    unsigned user_free_pages;           /* Of those, pages free. */
+  };
+
+#endif /* lib/sysstats.h */
@@ -153,6 +153,12 @@ munmap (mapid_t mapid)
   syscall1 (SYS_MUNMAP, mapid);
 }
 
+bool
+msync (mapid_t mapid)
+{
+  return syscall1 (SYS_MSYNC, mapid);
+}
+
 bool
 chdir (const char *dir)
 {
@@ -182,3 +188,33 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+bool
+fsync (int fd)
+{
+  return syscall1 (SYS_FSYNC, fd);
+}
+
+void
+sync (void)
+{
+  syscall0 (SYS_SYNC);
+}
+
+void
+sysstats (struct sysstats *stats)
+{
+  syscall1 (SYS_SYSSTATS, stats);
+}
+
+bool
+blockstats (const char *device, struct blockstats *stats)
+{
+  return syscall2 (SYS_BLOCKSTATS, device, stats);
+}
+
+pid_t
+fork (void)
+{
+  return (pid_t) syscall0 (SYS_FORK);
+}
@@ -3,6 +3,8 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <blockstats.h>
+#include <sysstats.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -37,6 +39,7 @@ void close (int fd);
 /* Project 3 and optionally project 4. */
 mapid_t mmap (int fd, void *addr);
 void munmap (mapid_t);
+bool msync (mapid_t);
 
 /* Project 4 only. */
 bool chdir (const char *dir);
@@ -44,5 +47,14 @@ bool mkdir (const char *dir);
 bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
+bool fsync (int fd);
+void sync (void);
+
+/* Measurement. */
+void sysstats (struct sysstats *);
+bool blockstats (const char *device, struct blockstats *);
+
+/* Process creation. */
+pid_t fork (void);
 
 #endif /* lib/user/syscall.h */
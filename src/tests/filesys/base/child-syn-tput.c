@@ -0,0 +1,52 @@
+/* Child process for syn-tput test.
+   Creates a file of its own, writes it a chunk at a time, reads
+   it back and verifies it, and removes it.  Other processes will
+   be doing the same to other files at the same time. */
+
+#include <random.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/filesys/base/syn-tput.h"
+
+const char *test_name = "child-syn-tput";
+
+static char buf[FILE_SIZE];
+static char chunk[CHUNK_SIZE];
+
+int
+main (int argc, const char *argv[]) 
+{
+  char file_name[16];
+  int child_idx;
+  int fd;
+  size_t ofs;
+
+  quiet = true;
+
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+  snprintf (file_name, sizeof file_name, "tput%d", child_idx);
+
+  random_init (child_idx);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  for (ofs = 0; ofs < sizeof buf; ofs += CHUNK_SIZE)
+    CHECK (write (fd, buf + ofs, CHUNK_SIZE) == CHUNK_SIZE,
+           "write \"%s\" at %zu", file_name, ofs);
+
+  seek (fd, 0);
+  for (ofs = 0; ofs < sizeof buf; ofs += CHUNK_SIZE)
+    {
+      CHECK (read (fd, chunk, CHUNK_SIZE) == CHUNK_SIZE,
+             "read \"%s\" at %zu", file_name, ofs);
+      compare_bytes (chunk, buf + ofs, CHUNK_SIZE, ofs, file_name);
+    }
+  close (fd);
+  CHECK (remove (file_name), "remove \"%s\"", file_name);
+
+  return child_idx;
+}
@@ -0,0 +1,54 @@
+/* Spawns several child processes that each stream a private file
+   through the file system, first one at a time and then all at
+   once.  The children share no files, so with internally
+   synchronized file system code the parallel round should take
+   little longer than a single child.  Each round is timed with
+   sysstats(), both times are reported, and the test fails if the
+   parallel round takes longer than the serial one: running the
+   children at once must not cost more than running them in
+   turn. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include <sysstats.h>
+#include "tests/filesys/base/syn-tput.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Ticks by which the parallel round may exceed the serial one,
+   for timer granularity. */
+#define SLACK CHILD_CNT
+
+void
+test_main (void) 
+{
+  pid_t children[CHILD_CNT];
+  struct sysstats start, end;
+  int64_t serial, parallel;
+  int i;
+
+  msg ("serial round");
+  sysstats (&start);
+  for (i = 0; i < CHILD_CNT; i++)
+    {
+      char cmd_line[32];
+      snprintf (cmd_line, sizeof cmd_line, "child-syn-tput %d", i);
+      CHECK ((children[i] = exec (cmd_line)) != PID_ERROR,
+             "exec \"%s\"", cmd_line);
+      CHECK (wait (children[i]) == i, "wait for \"%s\"", cmd_line);
+    }
+  sysstats (&end);
+  serial = end.ticks - start.ticks;
+  msg ("serial round: %lld ticks", serial);
+
+  msg ("parallel round");
+  sysstats (&start);
+  exec_children ("child-syn-tput", children, CHILD_CNT);
+  wait_children (children, CHILD_CNT);
+  sysstats (&end);
+  parallel = end.ticks - start.ticks;
+  msg ("parallel round: %lld ticks", parallel);
+  if (parallel > serial + SLACK)
+    fail ("parallel round took %lld ticks, serial round %lld",
+          parallel, serial);
+}
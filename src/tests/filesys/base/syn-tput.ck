@@ -0,0 +1,41 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+@output = grep (!/^[-a-z]+: exit\(-?\d+\)$/,
+		get_core_output ("run", @output));
+
+my (@expected) = ("(syn-tput) begin",
+		  "(syn-tput) serial round",
+		  "(syn-tput) exec \"child-syn-tput 0\"",
+		  "(syn-tput) wait for \"child-syn-tput 0\"",
+		  "(syn-tput) exec \"child-syn-tput 1\"",
+		  "(syn-tput) wait for \"child-syn-tput 1\"",
+		  "(syn-tput) exec \"child-syn-tput 2\"",
+		  "(syn-tput) wait for \"child-syn-tput 2\"",
+		  "(syn-tput) exec \"child-syn-tput 3\"",
+		  "(syn-tput) wait for \"child-syn-tput 3\"",
+		  qr/^\(syn-tput\) serial round: \d+ ticks$/,
+		  "(syn-tput) parallel round",
+		  "(syn-tput) exec child 1 of 4: \"child-syn-tput 0\"",
+		  "(syn-tput) exec child 2 of 4: \"child-syn-tput 1\"",
+		  "(syn-tput) exec child 3 of 4: \"child-syn-tput 2\"",
+		  "(syn-tput) exec child 4 of 4: \"child-syn-tput 3\"",
+		  "(syn-tput) wait for child 1 of 4 returned 0 (expected 0)",
+		  "(syn-tput) wait for child 2 of 4 returned 1 (expected 1)",
+		  "(syn-tput) wait for child 3 of 4 returned 2 (expected 2)",
+		  "(syn-tput) wait for child 4 of 4 returned 3 (expected 3)",
+		  qr/^\(syn-tput\) parallel round: \d+ ticks$/,
+		  "(syn-tput) end");
+fail "Expected " . scalar (@expected) . " lines of output, got "
+  . scalar (@output) . ":\n" . join ("\n", @output) . "\n"
+  if @output != @expected;
+for my $i (0...$#expected) {
+    my ($e, $o) = ($expected[$i], $output[$i]);
+    fail "Unexpected output line \"$o\"\n"
+      if ref ($e) ? $o !~ $e : $o ne $e;
+}
+pass;
@@ -0,0 +1,8 @@
+#ifndef TESTS_FILESYS_BASE_SYN_TPUT_H
+#define TESTS_FILESYS_BASE_SYN_TPUT_H
+
+#define CHILD_CNT 4
+#define CHUNK_SIZE 512
+#define FILE_SIZE (64 * CHUNK_SIZE)
+
+#endif /* tests/filesys/base/syn-tput.h */
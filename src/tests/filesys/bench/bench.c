@@ -0,0 +1,36 @@
+#include "tests/filesys/bench/bench.h"
+#include <syscall.h>
+#include "tests/lib.h"
+
+/* Starts measuring the workload called NAME.  Writes back the
+   buffer cache first, so that earlier setup is not charged to
+   it. */
+void
+bench_start (struct bench *b, const char *name)
+{
+  b->name = name;
+  sync ();
+  sysstats (&b->start);
+}
+
+/* Stops measuring B, which made SYSCALL_CNT system calls, and
+   reports elapsed ticks, system calls per second and sectors
+   transferred.  Writes back the buffer cache first, so that
+   writes it has merely deferred are charged to B. */
+void
+bench_end (struct bench *b, int syscall_cnt)
+{
+  struct sysstats end;
+  int64_t ticks;
+
+  sync ();
+  sysstats (&end);
+
+  ticks = end.ticks - b->start.ticks;
+  msg ("%s: %lld ticks, %d syscalls, %lld syscalls/s, "
+       "%llu sectors read, %llu sectors written",
+       b->name, ticks, syscall_cnt,
+       ticks > 0 ? (int64_t) syscall_cnt * end.timer_freq / ticks : 0,
+       end.fs_reads - b->start.fs_reads,
+       end.fs_writes - b->start.fs_writes);
+}
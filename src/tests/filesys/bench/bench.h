@@ -0,0 +1,16 @@
+#ifndef TESTS_FILESYS_BENCH_BENCH_H
+#define TESTS_FILESYS_BENCH_BENCH_H
+
+#include <sysstats.h>
+
+/* Measurement in progress. */
+struct bench
+  {
+    const char *name;                   /* Workload name. */
+    struct sysstats start;              /* Statistics at bench_start(). */
+  };
+
+void bench_start (struct bench *, const char *name);
+void bench_end (struct bench *, int syscall_cnt);
+
+#endif /* tests/filesys/bench/bench.h */
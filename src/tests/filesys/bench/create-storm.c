@@ -0,0 +1,38 @@
+/* Creates and removes many small files in one directory. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/filesys/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 64
+#define ROUND_CNT 4
+
+void
+test_main (void)
+{
+  struct bench b;
+  char name[16];
+  int round, i;
+
+  CHECK (mkdir ("storm"), "mkdir \"storm\"");
+
+  bench_start (&b, "create/remove storm");
+  for (round = 0; round < ROUND_CNT; round++)
+    {
+      for (i = 0; i < FILE_CNT; i++)
+        {
+          snprintf (name, sizeof name, "storm/f%d", i);
+          if (!create (name, 512))
+            fail ("create \"%s\" failed", name);
+        }
+      for (i = 0; i < FILE_CNT; i++)
+        {
+          snprintf (name, sizeof name, "storm/f%d", i);
+          if (!remove (name))
+            fail ("remove \"%s\" failed", name);
+        }
+    }
+  bench_end (&b, ROUND_CNT * FILE_CNT * 2);
+}
@@ -0,0 +1,38 @@
+/* Opens a file at the bottom of a deep directory tree. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/filesys/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define DEPTH 16
+#define OPEN_CNT 128
+
+void
+test_main (void)
+{
+  struct bench b;
+  char path[DEPTH * 4 + 8];
+  int i, fd;
+
+  path[0] = '\0';
+  for (i = 0; i < DEPTH; i++)
+    {
+      strlcat (path, i == 0 ? "d" : "/d", sizeof path);
+      if (!mkdir (path))
+        fail ("mkdir \"%s\" failed", path);
+    }
+  strlcat (path, "/f", sizeof path);
+  CHECK (create (path, 0), "create file at depth %d", DEPTH);
+
+  bench_start (&b, "deep directory lookup");
+  for (i = 0; i < OPEN_CNT; i++)
+    {
+      fd = open (path);
+      if (fd < 2)
+        fail ("open \"%s\" failed", path);
+      close (fd);
+    }
+  bench_end (&b, OPEN_CNT * 2);
+}
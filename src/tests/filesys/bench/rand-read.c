@@ -0,0 +1,41 @@
+/* Reads 4 kB blocks at random offsets in a 512 kB file. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/filesys/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE (512 * 1024)
+#define BLOCK_SIZE 4096
+#define READ_CNT 256
+
+static char buf[BLOCK_SIZE];
+
+void
+test_main (void)
+{
+  struct bench b;
+  int fd, ofs, i;
+
+  memset (buf, 0xa5, sizeof buf);
+  CHECK (create ("rand", FILE_SIZE), "create \"rand\"");
+  CHECK ((fd = open ("rand")) > 1, "open \"rand\"");
+  for (ofs = 0; ofs < FILE_SIZE; ofs += BLOCK_SIZE)
+    if (write (fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+      fail ("write %d bytes at offset %d failed", BLOCK_SIZE, ofs);
+
+  random_init (0);
+  bench_start (&b, "random 4 kB read");
+  for (i = 0; i < READ_CNT; i++)
+    {
+      ofs = random_ulong () % (FILE_SIZE / BLOCK_SIZE) * BLOCK_SIZE;
+      seek (fd, ofs);
+      if (read (fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+        fail ("read %d bytes at offset %d failed", BLOCK_SIZE, ofs);
+    }
+  bench_end (&b, READ_CNT * 2);
+
+  close (fd);
+}
@@ -0,0 +1,31 @@
+/* Writes a 512 kB file sequentially in 4 kB chunks. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/filesys/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE (512 * 1024)
+#define CHUNK_SIZE 4096
+
+static char buf[CHUNK_SIZE];
+
+void
+test_main (void)
+{
+  struct bench b;
+  int fd, ofs;
+
+  memset (buf, 0x5a, sizeof buf);
+  CHECK (create ("seq", 0), "create \"seq\"");
+  CHECK ((fd = open ("seq")) > 1, "open \"seq\"");
+
+  bench_start (&b, "sequential write");
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE)
+    if (write (fd, buf, CHUNK_SIZE) != CHUNK_SIZE)
+      fail ("write %d bytes at offset %d failed", CHUNK_SIZE, ofs);
+  bench_end (&b, FILE_SIZE / CHUNK_SIZE);
+
+  close (fd);
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($fs);
+foreach my $i (0...79) {
+    my ($name) = sprintf ("%02d", $i);
+    $name .= $i % 2 ? 'y' x 12 : 'x' x ($i % 13);
+    $fs->{'v'}{$name} = [''];
+}
+check_archive ($fs);
+pass;
@@ -0,0 +1,110 @@
+/* Fills a directory in the variable-length record format
+   (-dirfmt=var) with files whose names run from 2 to 14
+   characters, enough to span several sectors.  Then removes every
+   other file, so that removed records merge into their
+   predecessors and some sectors start with a free record, and
+   creates files with longer names in the space freed.  After each
+   step, checks that readdir lists exactly the files that should
+   be there. */
+
+#include <string.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 80
+
+/* Stores into NAME the name of file I: its two-digit number,
+   padded to a length from 2 to 14 with 'x's, or, if LONG_, to 14
+   with 'y's. */
+static void
+file_name (char name[READDIR_MAX_LEN + 1], int i, bool long_)
+{
+  size_t len = long_ ? READDIR_MAX_LEN : 2 + i % 13;
+
+  snprintf (name, READDIR_MAX_LEN + 1, "%02d", i);
+  memset (name + 2, long_ ? 'y' : 'x', len - 2);
+  name[len] = '\0';
+}
+
+/* Checks that directory "v" lists exactly the files named by
+   file_name(I, LONG_[I]) for each I with PRESENT[I] true. */
+static void
+check_dir (const bool present[FILE_CNT], const bool long_[FILE_CNT])
+{
+  bool seen[FILE_CNT];
+  char name[READDIR_MAX_LEN + 1];
+  int fd, cnt = 0, i;
+
+  memset (seen, 0, sizeof seen);
+  CHECK ((fd = open ("v")) > 1, "open \"v\"");
+  while (readdir (fd, name))
+    {
+      char expected[READDIR_MAX_LEN + 1];
+
+      i = (name[0] - '0') * 10 + (name[1] - '0');
+      if (i < 0 || i >= FILE_CNT || !present[i])
+        fail ("readdir listed unexpected \"%s\"", name);
+      file_name (expected, i, long_[i]);
+      if (strcmp (name, expected))
+        fail ("readdir listed \"%s\", expected \"%s\"", name, expected);
+      if (seen[i])
+        fail ("readdir listed \"%s\" twice", name);
+      seen[i] = true;
+      cnt++;
+    }
+  close (fd);
+
+  for (i = 0; i < FILE_CNT; i++)
+    if (present[i] && !seen[i])
+      {
+        file_name (name, i, long_[i]);
+        fail ("readdir did not list \"%s\"", name);
+      }
+  msg ("readdir listed %d files", cnt);
+}
+
+void
+test_main (void)
+{
+  bool present[FILE_CNT], long_[FILE_CNT];
+  char path[READDIR_MAX_LEN + 3];
+  int i;
+
+  CHECK (mkdir ("v"), "mkdir \"v\"");
+
+  msg ("create %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      strlcpy (path, "v/", sizeof path);
+      file_name (path + 2, i, false);
+      if (!create (path, 0))
+        fail ("create \"%s\"", path);
+      present[i] = true;
+      long_[i] = false;
+    }
+  check_dir (present, long_);
+
+  msg ("remove odd-numbered files");
+  for (i = 1; i < FILE_CNT; i += 2)
+    {
+      strlcpy (path, "v/", sizeof path);
+      file_name (path + 2, i, false);
+      if (!remove (path))
+        fail ("remove \"%s\"", path);
+      present[i] = false;
+    }
+  check_dir (present, long_);
+
+  msg ("create them again with long names");
+  for (i = 1; i < FILE_CNT; i += 2)
+    {
+      strlcpy (path, "v/", sizeof path);
+      file_name (path + 2, i, true);
+      if (!create (path, 0))
+        fail ("create \"%s\"", path);
+      present[i] = long_[i] = true;
+    }
+  check_dir (present, long_);
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-var) begin
+(dir-var) mkdir "v"
+(dir-var) create 80 files
+(dir-var) open "v"
+(dir-var) readdir listed 80 files
+(dir-var) remove odd-numbered files
+(dir-var) open "v"
+(dir-var) readdir listed 40 files
+(dir-var) create them again with long names
+(dir-var) open "v"
+(dir-var) readdir listed 80 files
+(dir-var) end
+EOF
+pass;
@@ -0,0 +1,35 @@
+/* Writes a file and a directory entry, flushes them with fsync()
+   and sync(), and checks that the contents are unchanged. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 6000
+static char buf[FILE_SIZE];
+
+void
+test_main (void) 
+{
+  int fd, dir_fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (mkdir ("d"), "mkdir \"d\"");
+  CHECK (create ("d/data", 0), "create \"d/data\"");
+  CHECK ((fd = open ("d/data")) > 1, "open \"d/data\"");
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf, "write \"d/data\"");
+  CHECK (fsync (fd), "fsync \"d/data\"");
+  CHECK ((dir_fd = open ("d")) > 1, "open \"d\"");
+  CHECK (fsync (dir_fd), "fsync \"d\"");
+  msg ("close \"d\"");
+  close (dir_fd);
+  msg ("close \"d/data\"");
+  close (fd);
+  CHECK (!fsync (fd), "fsync closed fd (must return false)");
+  msg ("sync");
+  sync ();
+  check_file ("d/data", buf, sizeof buf);
+}
@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fsync-file) begin
+(fsync-file) mkdir "d"
+(fsync-file) create "d/data"
+(fsync-file) open "d/data"
+(fsync-file) write "d/data"
+(fsync-file) fsync "d/data"
+(fsync-file) open "d"
+(fsync-file) fsync "d"
+(fsync-file) close "d"
+(fsync-file) close "d/data"
+(fsync-file) fsync closed fd (must return false)
+(fsync-file) sync
+(fsync-file) open "d/data" for verification
+(fsync-file) verified contents of "d/data"
+(fsync-file) close "d/data"
+(fsync-file) end
+EOF
+pass;
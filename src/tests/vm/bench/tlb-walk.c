@@ -0,0 +1,78 @@
+/* Maps a 4 MB file at a 4 MB aligned address and reads one word
+   from each of its pages, in a fixed random order, many times
+   over.  With 4 kB pages the walk touches far more pages than
+   the TLB holds, so nearly every read misses; with a single
+   4 MB page (see tlb-walk-large) every read hits. */
+
+#include <inttypes.h>
+#include <random.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define MAP_SIZE (4 * 1024 * 1024)
+#define PAGE_SIZE 4096
+#define PAGE_CNT (MAP_SIZE / PAGE_SIZE)
+#define ROUND_CNT 256
+
+#define ACTUAL ((void *) 0x10000000)
+
+static uint32_t page[PAGE_SIZE / sizeof (uint32_t)];
+static int order[PAGE_CNT];
+
+void
+test_main (void)
+{
+  struct sysstats start, end;
+  const uint32_t *map = ACTUAL;
+  int64_t ticks, access_cnt;
+  uint32_t sum = 0;
+  int fd, i, j;
+
+  CHECK (create ("walk", MAP_SIZE), "create \"walk\"");
+  CHECK ((fd = open ("walk")) > 1, "open \"walk\"");
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      page[0] = i;
+      if (write (fd, page, PAGE_SIZE) != PAGE_SIZE)
+        fail ("write page %d failed", i);
+    }
+  CHECK (mmap (fd, ACTUAL) != MAP_FAILED, "mmap \"walk\"");
+
+  /* Visit the pages in a random order, so that hardware and
+     simulator prefetching cannot hide the misses. */
+  random_init (0);
+  for (i = 0; i < PAGE_CNT; i++)
+    order[i] = i;
+  for (i = PAGE_CNT - 1; i > 0; i--)
+    {
+      int k = random_ulong () % (i + 1);
+      int tmp = order[i];
+      order[i] = order[k];
+      order[k] = tmp;
+    }
+
+  /* Fault in every page before measuring. */
+  for (i = 0; i < PAGE_CNT; i++)
+    if (map[i * (PAGE_SIZE / sizeof *map)] != (uint32_t) i)
+      fail ("page %d of \"walk\" has bad data", i);
+
+  sysstats (&start);
+  for (j = 0; j < ROUND_CNT; j++)
+    for (i = 0; i < PAGE_CNT; i++)
+      sum += map[order[i] * (PAGE_SIZE / sizeof *map)];
+  sysstats (&end);
+
+  if (sum != (uint32_t) ROUND_CNT * PAGE_CNT * (PAGE_CNT - 1) / 2)
+    fail ("sum of page numbers is %"PRIu32, sum);
+
+  ticks = end.ticks - start.ticks;
+  access_cnt = (int64_t) ROUND_CNT * PAGE_CNT;
+  msg ("random page walk: %lld ticks, %lld reads, %lld reads/s",
+       ticks, access_cnt,
+       ticks > 0 ? access_cnt * end.timer_freq / ticks : 0);
+
+  close (fd);
+}
@@ -0,0 +1,22 @@
+/* Child process of page-exit-lat.
+   Touches a few pages of its own, then exits with the current
+   timer tick count as its exit code. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+
+const char *test_name = "child-exit";
+
+#define SIZE (16 * 4096)
+static char buf[SIZE];
+
+int
+main (void)
+{
+  struct sysstats stats;
+
+  memset (buf, 0xa5, sizeof buf);
+  sysstats (&stats);
+  return stats.ticks;
+}
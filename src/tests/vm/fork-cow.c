@@ -0,0 +1,57 @@
+/* Forks a child that checks it sees its parent's memory, then
+   overwrites that memory, both directly and through the read
+   system call.  The parent then verifies that its own copy is
+   unchanged, as copy-on-write requires. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (64 * 1024)
+
+static char buf[SIZE];
+
+static void
+check_fill (const char *what, size_t ofs, size_t size, char c)
+{
+  size_t i;
+
+  for (i = ofs; i < ofs + size; i++)
+    if (buf[i] != c)
+      fail ("%s: byte %zu is %02hhx, should be %02hhx", what, i, buf[i], c);
+}
+
+void
+test_main (void)
+{
+  int handle;
+  pid_t child;
+
+  msg ("fill %d kB", SIZE / 1024);
+  memset (buf, 'p', SIZE);
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+
+  msg ("fork");
+  child = fork ();
+  if (child == 0)
+    {
+      /* Child: no messages, so that the output is ordered. */
+      check_fill ("child before write", 0, SIZE, 'p');
+      memset (buf, 'c', SIZE / 2);
+      if (read (handle, buf + SIZE / 2, strlen (sample)) != (int) strlen (sample))
+        fail ("child read \"sample.txt\"");
+      check_fill ("child after write", 0, SIZE / 2, 'c');
+      if (memcmp (buf + SIZE / 2, sample, strlen (sample)))
+        fail ("child read bad data");
+      exit (81);
+    }
+  /* Nothing printed until the wait: the child may exit first. */
+  if (child == PID_ERROR)
+    fail ("fork");
+
+  msg ("wait(fork()) = %d", wait (child));
+  check_fill ("parent after child exited", 0, SIZE, 'p');
+  msg ("parent memory unchanged");
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fork-cow) begin
+(fork-cow) fill 64 kB
+(fork-cow) open "sample.txt"
+(fork-cow) fork
+fork-cow: exit(81)
+(fork-cow) wait(fork()) = 81
+(fork-cow) parent memory unchanged
+(fork-cow) end
+fork-cow: exit(0)
+EOF
+pass;
@@ -0,0 +1,59 @@
+/* Writes to some pages of a mapped file, leaving a gap, syncs
+   the mapping, and reads the file back using the read system
+   call, while it is still mapped, to verify.  Then checks that
+   a second write reaches the file on munmap. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((void *) 0x10000000)
+#define PAGE_SIZE 4096
+#define PAGE_CNT 5
+
+static char buf[PAGE_SIZE * PAGE_CNT];
+
+/* Reads the whole of the file open as HANDLE into BUF and checks
+   that page I is filled with EXPECT[I]. */
+static void
+check_pages (int handle, const char *expect)
+{
+  int i, j;
+
+  seek (handle, 0);
+  if (read (handle, buf, sizeof buf) != (int) sizeof buf)
+    fail ("read \"msync\" failed");
+  for (i = 0; i < PAGE_CNT; i++)
+    for (j = 0; j < PAGE_SIZE; j++)
+      if (buf[i * PAGE_SIZE + j] != expect[i])
+        fail ("byte %d of page %d is %02hhx, should be %02hhx",
+              j, i, buf[i * PAGE_SIZE + j], expect[i]);
+}
+
+void
+test_main (void)
+{
+  char *actual = ACTUAL;
+  int handle;
+  mapid_t map;
+
+  CHECK (create ("msync", sizeof buf), "create \"msync\"");
+  CHECK ((handle = open ("msync")) > 1, "open \"msync\"");
+  CHECK ((map = mmap (handle, actual)) != MAP_FAILED, "mmap \"msync\"");
+
+  /* Dirty pages 0 to 2 and 4, but not 3. */
+  memset (actual, 'a', PAGE_SIZE * 3);
+  memset (actual + PAGE_SIZE * 4, 'b', PAGE_SIZE);
+  CHECK (msync (map), "msync");
+  check_pages (handle, "aaa\0b");
+  msg ("verify synced data");
+
+  memset (actual + PAGE_SIZE * 3, 'c', PAGE_SIZE);
+  munmap (map);
+  check_pages (handle, "aaacb");
+  msg ("verify unmapped data");
+
+  CHECK (!msync (map), "msync after munmap fails");
+  close (handle);
+}
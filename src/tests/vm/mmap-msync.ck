@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-msync) begin
+(mmap-msync) create "msync"
+(mmap-msync) open "msync"
+(mmap-msync) mmap "msync"
+(mmap-msync) msync
+(mmap-msync) verify synced data
+(mmap-msync) verify unmapped data
+(mmap-msync) msync after munmap fails
+(mmap-msync) end
+EOF
+pass;
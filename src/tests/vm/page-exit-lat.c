@@ -0,0 +1,80 @@
+/* Repeatedly runs a small child process and measures how long
+   each one takes to exit: from just before its exit system call,
+   as reported in its exit code, until the parent's wait returns.
+   Does so once holding nothing, as a baseline, and once holding
+   most of the user pool.  Tearing down the child should take
+   time in proportion to its own pages, not to those held by the
+   parent, so the second round should take about as long as the
+   first. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define MAX_HOLD (8 * 1024 * 1024)
+#define CHILD_CNT 20
+
+/* Ticks by which the second round may exceed twice the first,
+   for timer granularity. */
+#define SLACK CHILD_CNT
+
+static char buf[MAX_HOLD];
+
+/* Runs CHILD_CNT children in turn and returns the total ticks
+   spent between their exits and the returns of their waits. */
+static int64_t
+run_children (void)
+{
+  struct sysstats stats;
+  int64_t total = 0;
+  int i;
+
+  for (i = 0; i < CHILD_CNT; i++)
+    {
+      pid_t child = exec ("child-exit");
+      int exit_ticks;
+
+      if (child == -1)
+        fail ("exec \"child-exit\"");
+      exit_ticks = wait (child);
+      sysstats (&stats);
+      if (exit_ticks < 0 || exit_ticks > stats.ticks)
+        fail ("child %d exited with %d", i, exit_ticks);
+      total += stats.ticks - exit_ticks;
+    }
+  return total;
+}
+
+void
+test_main (void)
+{
+  struct sysstats stats;
+  int64_t baseline, held;
+  size_t hold, i;
+
+  msg ("run %d children holding nothing", CHILD_CNT);
+  baseline = run_children ();
+  msg ("baseline: %lld ticks", baseline);
+
+  /* Three quarters of the user pool's free pages. */
+  sysstats (&stats);
+  hold = (size_t) stats.user_free_pages / 4 * 3 * PAGE_SIZE;
+  if (hold > sizeof buf)
+    hold = sizeof buf;
+  msg ("hold %zu of %u user pages", hold / PAGE_SIZE, stats.user_pages);
+  memset (buf, 0x5a, hold);
+
+  msg ("run %d children holding them", CHILD_CNT);
+  held = run_children ();
+  msg ("holding: %lld ticks", held);
+  if (held > 2 * baseline + SLACK)
+    fail ("exit latency grew from %lld to %lld ticks with memory held",
+          baseline, held);
+
+  msg ("verify held memory");
+  for (i = 0; i < hold; i++)
+    if (buf[i] != 0x5a)
+      fail ("byte %zu != 0x5a", i);
+}
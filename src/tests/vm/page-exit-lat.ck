@@ -0,0 +1,28 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+@output = grep (!/^child-exit: exit\(\d+\)$/,
+		get_core_output ("run", @output));
+
+my (@expected) = ("(page-exit-lat) begin",
+		  "(page-exit-lat) run 20 children holding nothing",
+		  qr/^\(page-exit-lat\) baseline: \d+ ticks$/,
+		  qr/^\(page-exit-lat\) hold \d+ of \d+ user pages$/,
+		  "(page-exit-lat) run 20 children holding them",
+		  qr/^\(page-exit-lat\) holding: \d+ ticks$/,
+		  "(page-exit-lat) verify held memory",
+		  "(page-exit-lat) end",
+		  "page-exit-lat: exit(0)");
+fail "Expected " . scalar (@expected) . " lines of output, got "
+  . scalar (@output) . ":\n" . join ("\n", @output) . "\n"
+  if @output != @expected;
+for my $i (0...$#expected) {
+    my ($e, $o) = ($expected[$i], $output[$i]);
+    fail "Unexpected output line \"$o\"\n"
+      if ref ($e) ? $o !~ $e : $o ne $e;
+}
+pass;
@@ -33,14 +33,29 @@
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
+#include "devices/block_queue.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
+#include "devices/stripe.h"
+#include "devices/virtio_blk.h"
+#include "filesys/directory.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+#include "vm/zswap.h"
+#endif
 
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
 
+/* True if 4 MB pages are in use.  Cleared by -nopse, or by
+   paging_init() if the CPU lacks them. */
+bool pse_enabled = true;
+
 #ifdef FILESYS
 /* -f: Format the file system? */
 static bool format_filesys;
@@ -52,12 +67,16 @@ static const char *scratch_bdev_name;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
+
+/* -ramdisk: Size of RAM disk to create, in kB, or 0 for none. */
+static size_t ramdisk_kb;
 #endif /* FILESYS */
 
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
 static void bss_init (void);
+static bool pse_init (void);
 static void paging_init (void);
 
 static char **read_command_line (void);
@@ -124,6 +143,9 @@ main (void)
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
+  virtio_blk_init ();
+  if (ramdisk_kb > 0)
+    ramdisk_init (ramdisk_kb);
   locate_block_devices ();
   filesys_init (format_filesys);
 
@@ -154,6 +176,30 @@ bss_init (void)
   memset (&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+/* Enables 4 MB pages, by setting CR4.PSE, and returns true, if
+   the CPU supports them, or returns false if it does not.  See
+   [IA32-v2a] "CPUID--CPU Identification" and [IA32-v3a] 3.6.1
+   "Paging Options". */
+static bool
+pse_init (void)
+{
+  enum
+    {
+      CPUID_PSE = 1 << 3,               /* CPUID 1 EDX: has PSE. */
+      CR4_PSE = 1 << 4                  /* CR4: enable PSE. */
+    };
+  uint32_t eax, ebx, ecx, edx, cr4;
+
+  asm volatile ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                : "a" (1));
+  if (!(edx & CPUID_PSE))
+    return false;
+
+  asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+  asm volatile ("movl %0, %%cr4" : : "r" (cr4 | CR4_PSE));
+  return true;
+}
+
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
@@ -165,6 +211,9 @@ paging_init (void)
   size_t page;
   extern char _start, _end_kernel_text;
 
+  if (pse_enabled)
+    pse_enabled = pse_init ();
+
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   pt = NULL;
   for (page = 0; page < init_ram_pages; page++)
@@ -175,6 +224,18 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      /* Map each whole 4 MB of RAM with a single large page, and
+         so a single TLB entry, unless it holds kernel text, which
+         must stay read-only. */
+      if (pse_enabled && pte_idx == 0
+          && page + PTSPAN / PGSIZE <= init_ram_pages
+          && (vaddr + PTSPAN <= &_start || vaddr >= &_end_kernel_text))
+        {
+          pd[pde_idx] = pde_create_large_kernel (vaddr, true);
+          page += PTSPAN / PGSIZE - 1;
+          continue;
+        }
+
       if (pd[pde_idx] == 0)
         {
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
@@ -251,11 +312,44 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-dirfmt"))
+        {
+          if (value != NULL && !strcmp (value, "var"))
+            dir_format = DIR_FMT_VAR;
+          else if (value != NULL && !strcmp (value, "fixed"))
+            dir_format = DIR_FMT_FIXED;
+          else
+            PANIC ("unknown directory format `%s'", value);
+        }
+      else if (!strcmp (name, "-ramdisk"))
+        ramdisk_kb = atoi (value);
+      else if (!strcmp (name, "-nodma"))
+        ide_use_dma = false;
+      else if (!strcmp (name, "-iosched"))
+        {
+          if (value == NULL || !block_queue_set_scheduler (value))
+            PANIC ("unknown I/O scheduler `%s'", value);
+        }
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
+      else if (!strcmp (name, "-zswap"))
+        zswap_pages = atoi (value);
+      else if (!strcmp (name, "-faultaround"))
+        fault_around_pages = atoi (value);
+      else if (!strcmp (name, "-largepages"))
+        mmap_large_pages = true;
+      else if (!strcmp (name, "-writeback"))
+        writeback_secs = atoi (value);
+      else if (!strcmp (name, "-vmpolicy"))
+        {
+          if (value == NULL || !reclaim_set_policy (value))
+            PANIC ("unknown page replacement policy `%s'", value);
+        }
 #endif
 #endif
+      else if (!strcmp (name, "-nopse"))
+        pse_enabled = false;
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
@@ -376,11 +470,28 @@ usage (void)
 #ifdef FILESYS
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
+          "                     (Here and below, BDEV,BDEV... stripes several.)\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -dirfmt=FMT        Format directories as FMT (fixed or var).\n"
+          "  -ramdisk=SIZE      Create RAM disk \"ram0\" of SIZE kB.\n"
+          "  -nodma             Use PIO instead of DMA for IDE disks.\n"
+          "  -iosched=SCHED     Order disk requests by SCHED (fifo, clook,\n"
+          "                     or deadline).\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
+          "  -zswap=PAGES       Cache swap in PAGES pages of compressed RAM\n"
+          "                     (default 0, disabled).\n"
+          "  -faultaround=N     Load up to N pages per file-backed page\n"
+          "                     fault (1 disables).\n"
+          "  -largepages        Map aligned 4 MB spans of files with 4 MB\n"
+          "                     pages, read in by mmap.\n"
+          "  -writeback=SECS    Write back dirty mapped pages every SECS\n"
+          "                     seconds (0, the default, disables).\n"
+          "  -vmpolicy=POLICY   Replace pages by POLICY (clock, the default,\n"
+          "                     or aging).\n"
 #endif
 #endif
+          "  -nopse             Use 4 kB pages only, not 4 MB pages.\n"
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
@@ -405,13 +516,16 @@ locate_block_devices (void)
 /* Figures out what block device to use for the given ROLE: the
    block device with the given NAME, if NAME is non-null,
    otherwise the first block device in probe order of type
-   ROLE. */
+   ROLE.  A NAME that lists several block devices separated by
+   commas stands for a new device striped across them. */
 static void
 locate_block_device (enum block_type role, const char *name)
 {
   struct block *block = NULL;
 
-  if (name != NULL)
+  if (name != NULL && strchr (name, ',') != NULL)
+    block = stripe_create (role, name);
+  else if (name != NULL)
     {
       block = block_get_by_name (name);
       if (block == NULL)
@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -31,6 +32,7 @@ struct pool
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
     uint8_t *base;                      /* Base of pool. */
+    size_t free_cnt;                    /* Number of free pages. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -39,6 +41,7 @@ static struct pool kernel_pool, user_pool;
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static void adjust_free_cnt (struct pool *, size_t page_cnt, bool freed);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -79,6 +82,8 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 
   lock_acquire (&pool->lock);
   page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+  if (page_idx != BITMAP_ERROR)
+    adjust_free_cnt (pool, page_cnt, false);
   lock_release (&pool->lock);
 
   if (page_idx != BITMAP_ERROR)
@@ -100,6 +105,50 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   return pages;
 }
 
+/* Obtains and returns a group of PAGE_CNT contiguous free pages,
+   as palloc_get_multiple(), whose physical address is a multiple
+   of ALIGN pages.  ALIGN must be a power of 2. */
+void *
+palloc_get_aligned (enum palloc_flags flags, size_t page_cnt, size_t align)
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  size_t pool_cnt = bitmap_size (pool->used_map);
+  void *pages = NULL;
+  size_t page_idx;
+
+  ASSERT (align != 0 && (align & (align - 1)) == 0);
+  if (page_cnt == 0)
+    return NULL;
+
+  /* Try each aligned run in turn.  The kernel maps physical
+     memory at a 4 MB aligned address, so virtual and physical
+     alignment agree. */
+  lock_acquire (&pool->lock);
+  for (page_idx = -pg_no (pool->base) & (align - 1);
+       page_idx + page_cnt <= pool_cnt; page_idx += align)
+    if (bitmap_none (pool->used_map, page_idx, page_cnt))
+      {
+        bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+        adjust_free_cnt (pool, page_cnt, false);
+        pages = pool->base + PGSIZE * page_idx;
+        break;
+      }
+  lock_release (&pool->lock);
+
+  if (pages != NULL)
+    {
+      if (flags & PAL_ZERO)
+        memset (pages, 0, PGSIZE * page_cnt);
+    }
+  else
+    {
+      if (flags & PAL_ASSERT)
+        PANIC ("palloc_get: out of pages");
+    }
+
+  return pages;
+}
+
 /* Obtains a single free page and returns its kernel virtual
    address.
    If PAL_USER is set, the page is obtained from the user pool,
@@ -139,6 +188,7 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  adjust_free_cnt (pool, page_cnt, true);
 }
 
 /* Frees the page at PAGE. */
@@ -148,6 +198,23 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Stores the address of the first page of the user pool into
+   *BASE and returns the number of pages in the user pool. */
+size_t
+palloc_user_pool (void **base)
+{
+  *base = user_pool.base;
+  return bitmap_size (user_pool.used_map);
+}
+
+/* Returns the number of free pages in the user pool.  The count
+   is read without locking, so it may be slightly stale. */
+size_t
+palloc_user_free_cnt (void)
+{
+  return user_pool.free_cnt;
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
@@ -167,6 +234,22 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
   lock_init (&p->lock);
   p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
   p->base = base + bm_pages * PGSIZE;
+  p->free_cnt = page_cnt;
+}
+
+/* Adds PAGE_CNT to POOL's count of free pages if FREED is true,
+   otherwise subtracts it.  Pages are freed without the pool's
+   lock, even with interrupts off as a dying thread's page is, so
+   interrupts are turned off instead. */
+static void
+adjust_free_cnt (struct pool *pool, size_t page_cnt, bool freed)
+{
+  enum intr_level old_level = intr_disable ();
+  if (freed)
+    pool->free_cnt += page_cnt;
+  else
+    pool->free_cnt -= page_cnt;
+  intr_set_level (old_level);
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -664,6 +664,7 @@ init_thread (struct thread *t, const char *name, int priority)
   list_push_back (&all_list, &t->allelem);
   //initializing child list
   list_init(&(t->child_list));
+  list_init(&t->resident_pages);
   //initializing nice and recent_cpu
   t->nice = NICE_DEFAULT;
   t->recent_cpu = RECENT_CPU_DEFAULT;
@@ -99,6 +99,8 @@ struct thread
     struct list_elem child_elem;        /* child list elem  */
     struct list child_list;				/* child list		*/	
 	struct list mmap_list;
+	struct list resident_pages;         /* Frames in use, by struct page's
+	                                       proc_elem, under lru_list_lock. */
 
     bool load;
     bool exit;
@@ -116,6 +118,8 @@ struct thread
 	int nice;
 	int recent_cpu;
 	struct dir *cur_dir;
+	int journal_depth;                  /* Nesting of journal_begin(). */
+	int journal_credits;                /* Journal credits left. */
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory.  */
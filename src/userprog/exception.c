@@ -5,6 +5,7 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "userprog/process.h"
+#include "vm/cow.h"
 #include "vm/page.h"
 
 /* Number of page faults processed. */
@@ -150,9 +151,19 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
-  if (!not_present)	exit(-1);
   struct vm_entry *vme = find_vme(fault_addr);
   if (vme == NULL)	exit(-1);
+  if (!not_present)
+  {
+	/* Write to a page shared copy-on-write since fork. */
+	if (write && vme->cow != NULL && vme->writable)
+	{
+		if (!cow_break(vme))
+			exit(-1);
+		return;
+	}
+	exit(-1);
+  }
   if (!handle_mm_fault(vme))	exit(-1);	
 
 
@@ -34,7 +34,9 @@ pagedir_destroy (uint32_t *pd)
 
   ASSERT (pd != init_page_dir);
   for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
-    if (*pde & PTE_P) 
+    if (*pde & PTE_PS)
+      palloc_free_multiple (pde_get_large_page (*pde), PTSPAN / PGSIZE);
+    else if (*pde & PTE_P) 
       {
         uint32_t *pt = pde_get_pt (*pde);
         uint32_t *pte;
@@ -52,7 +54,10 @@ pagedir_destroy (uint32_t *pd)
    If PD does not have a page table for VADDR, behavior depends
    on CREATE.  If CREATE is true, then a new page table is
    created and a pointer into it is returned.  Otherwise, a null
-   pointer is returned. */
+   pointer is returned.
+   If VADDR lies in a 4 MB large page, there is no page table,
+   and a pointer to the PDE, which serves as the PTE for every
+   page in the large page, is returned instead. */
 static uint32_t *
 lookup_page (uint32_t *pd, const void *vaddr, bool create)
 {
@@ -79,6 +84,8 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
       else
         return NULL;
     }
+  else if (*pde & PTE_PS)
+    return pde;
 
   /* Return the page table entry. */
   pt = pde_get_pt (*pde);
@@ -130,10 +137,67 @@ pagedir_get_page (uint32_t *pd, const void *uaddr)
   ASSERT (is_user_vaddr (uaddr));
   
   pte = lookup_page (pd, uaddr, false);
-  if (pte != NULL && (*pte & PTE_P) != 0)
-    return pte_get_page (*pte) + pg_ofs (uaddr);
-  else
+  if (pte == NULL || (*pte & PTE_P) == 0)
     return NULL;
+  else if (*pte & PTE_PS)
+    {
+      /* PTE is a large page's PDE.  (In a real PTE the same bit
+         selects a PAT memory type, which we never set.) */
+      return pde_get_large_page (*pte) + ((uintptr_t) uaddr & ~PDE_LARGE_ADDR);
+    }
+  else
+    return pte_get_page (*pte) + pg_ofs (uaddr);
+}
+
+/* Adds a mapping in page directory PD from the 4 MB of user
+   virtual memory starting at UPAGE to the 4 MB of physical
+   memory starting at kernel virtual address KPAGE, with a single
+   large page.  Both addresses must be 4 MB aligned.  If WRITABLE
+   is true, the mapping is read/write; otherwise it is
+   read-only.
+   Returns true if successful, false if 4 MB pages are not in use
+   or PD already has a page table for the range. */
+bool
+pagedir_set_large_page (uint32_t *pd, void *upage, void *kpage,
+                        bool writable)
+{
+  uint32_t *pde;
+
+  ASSERT (((uintptr_t) upage & ~PDE_LARGE_ADDR) == 0);
+  ASSERT (is_user_vaddr (upage));
+  ASSERT (pd != init_page_dir);
+
+  pde = pd + pd_no (upage);
+  if (!pse_enabled || *pde != 0)
+    return false;
+  *pde = pde_create_large_user (kpage, writable);
+  return true;
+}
+
+/* Returns true if user virtual page UPAGE lies in a large page in
+   PD. */
+bool
+pagedir_is_large_page (uint32_t *pd, const void *upage)
+{
+  ASSERT (is_user_vaddr (upage));
+  return (pd[pd_no (upage)] & PTE_PS) != 0;
+}
+
+/* Removes the large page that maps user virtual page UPAGE in
+   PD, which must exist, and returns the kernel virtual address
+   of its 4 MB of memory, which the caller must free. */
+void *
+pagedir_clear_large_page (uint32_t *pd, const void *upage)
+{
+  uint32_t *pde = pd + pd_no (upage);
+  void *kpage;
+
+  ASSERT (is_user_vaddr (upage));
+  ASSERT (*pde & PTE_PS);
+  kpage = pde_get_large_page (*pde);
+  *pde = 0;
+  invalidate_pagedir (pd);
+  return kpage;
 }
 
 /* Marks user virtual page UPAGE "not present" in page
@@ -156,6 +220,21 @@ pagedir_clear_page (uint32_t *pd, void *upage)
     }
 }
 
+/* Sets the writable bit to WRITABLE in the PTE for virtual page
+   VPAGE in PD, which must be mapped. */
+void
+pagedir_set_writable (uint32_t *pd, const void *vpage, bool writable)
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+
+  ASSERT (pte != NULL && (*pte & PTE_P) != 0);
+  if (writable)
+    *pte |= PTE_W;
+  else
+    *pte &= ~(uint32_t) PTE_W;
+  invalidate_pagedir (pd);
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PD is dirty,
    that is, if the page has been modified since the PTE was
    installed.
@@ -20,11 +20,15 @@
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "threads/malloc.h"
+#include "vm/cow.h"
 #include "vm/page.h"
 #include "vm/swap.h"
 #include "vm/frame.h"
+#include "vm/share.h"
 
 static thread_func start_process NO_RETURN;
+static thread_func start_fork NO_RETURN;
+static bool install_page (void *upage, void *kpage, bool writable);
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
 
 /* Starts a new thread running a user program loaded from
@@ -157,6 +161,166 @@ start_process (void *file_name_)
   NOT_REACHED ();
 }
 
+/* Arguments passed by process_fork() to start_fork(). */
+struct fork_args
+{
+	struct thread *parent;      /* Process calling fork(). */
+	struct intr_frame if_;      /* Its user context. */
+};
+
+/* Creates a child of the current process with a copy of its
+   address space and open files, which resumes from the system
+   call whose frame is F with a return value of 0.  Returns the
+   child's thread id, or TID_ERROR if it cannot be created. */
+tid_t
+process_fork (struct intr_frame *f)
+{
+	struct fork_args args;
+	struct thread *child;
+	tid_t tid;
+
+	args.parent = thread_current();
+	args.if_ = *f;
+	tid = thread_create(thread_current()->name, PRI_DEFAULT, start_fork, &args);
+	if (tid == TID_ERROR)
+		return TID_ERROR;
+
+	/* Wait for the child to finish with ARGS. */
+	child = get_child_process(tid);
+	sema_down(&child->sema_load);
+	return child->load ? tid : TID_ERROR;
+}
+
+/* Gives the current process copies of PARENT's executable and
+   file descriptors, at the same positions. */
+static bool
+fork_files (struct thread *parent)
+{
+	struct thread *cur = thread_current();
+	int fd;
+
+	cur->run_file = file_reopen(parent->run_file);
+	if (cur->run_file == NULL)
+		return false;
+	file_deny_write(cur->run_file);
+
+	for (fd = 2; fd < parent->next_fd; fd++)
+		if (parent->fdt[fd] != NULL)
+		{
+			cur->fdt[fd] = file_reopen(parent->fdt[fd]);
+			if (cur->fdt[fd] == NULL)
+				return false;
+			file_seek(cur->fdt[fd], file_tell(parent->fdt[fd]));
+		}
+	cur->next_fd = parent->next_fd;
+	return true;
+}
+
+/* Gives VME, the current process's copy of PARENT's PVME, the
+   contents of PVME's page.  A resident page is shared
+   copy-on-write, a swapped-out page is copied, and a page still
+   in the executable is left to be loaded on demand. */
+static bool
+fork_page (struct thread *parent, struct vm_entry *pvme, struct vm_entry *vme)
+{
+	for (;;)
+	{
+		if (pvme->is_loaded)
+		{
+			if (cow_share(parent, pvme, vme))
+				return true;
+			if (pvme->is_loaded)
+				return false;
+			/* Evicted meanwhile: copy it from swap. */
+		}
+		else if (pvme->type == VM_ANON)
+		{
+			struct page *page;
+
+			if (pvme->swap_slot == BITMAP_ERROR)
+				return false;
+			page = alloc_page(PAL_USER);
+			if (page == NULL)
+				return false;
+			swap_read(pvme->swap_slot, page->kaddr);
+			if (!install_page(vme->vaddr, page->kaddr, vme->writable))
+			{
+				free_page(page->kaddr);
+				return false;
+			}
+			page->vme = vme;
+			vme->is_loaded = true;
+			return true;
+		}
+		else
+			return true;
+	}
+}
+
+/* Gives the current process a copy of PARENT's address space,
+   except for its memory mappings, which are not inherited.  Costs
+   time in proportion to PARENT's page tables, not to the memory
+   they map. */
+static bool
+fork_vm (struct thread *parent)
+{
+	struct thread *cur = thread_current();
+	struct hash_iterator i;
+
+	hash_first(&i, &parent->vm);
+	while (hash_next(&i))
+	{
+		struct vm_entry *pvme = hash_entry(hash_cur(&i), struct vm_entry, elem);
+		struct vm_entry *vme;
+
+		if (pvme->type == VM_FILE)
+			continue;
+		vme = malloc(sizeof *vme);
+		if (vme == NULL)
+			return false;
+		memcpy(vme, pvme, sizeof *vme);
+		vme->is_loaded = false;
+		vme->swap_slot = BITMAP_ERROR;
+		vme->cow = NULL;
+		if (vme->type == VM_BIN)
+			vme->file = cur->run_file;
+		insert_vme(&cur->vm, vme);
+
+		/* Shared text is mapped from the shared table on demand. */
+		if (!share_page(vme) && !fork_page(parent, pvme, vme))
+			return false;
+	}
+	return true;
+}
+
+/* A thread function that sets up a process forked by
+   process_fork() and starts it running. */
+static void
+start_fork (void *args_)
+{
+	struct fork_args *args = args_;
+	struct thread *cur = thread_current();
+	struct intr_frame if_ = args->if_;
+	bool success;
+
+	vm_init(&cur->vm);
+	list_init(&cur->mmap_list);
+	cur->pagedir = pagedir_create();
+	process_activate();
+	success = cur->pagedir != NULL && fork_files(args->parent)
+		&& fork_vm(args->parent);
+
+	cur->load = success;
+	sema_up(&cur->sema_load);
+	if (!success)
+		thread_exit();
+
+	/* The child returns 0 from fork(). */
+	if_.eax = 0;
+	asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+	NOT_REACHED();
+}
+
 // return thread by thread id
 struct 
 thread *get_child_process (int pid)
@@ -207,24 +371,13 @@ void
 process_exit (void)
 {
   struct thread *cur = thread_current ();
-  struct list_elem *e, *tmp;
-  struct page *p;
   uint32_t *pd;
   int i;
 
 
   munmap(-1);
+  free_resident_pages();
 
-  for(e = list_begin(&lru_list); e != list_end(&lru_list);)
-  {
-  	tmp = list_next(e);
-	p = list_entry(e, struct page, lru);
-	if(p->thread->tid == cur->tid)
-	{
-		del_page_from_lru_list(p);
-	}
-	e= tmp;
-  }
 	/* FIle close */
   for (i=cur->next_fd-1; i>1; --i)
   {
@@ -382,19 +535,15 @@ load (const char *file_name, void (**eip) (void), void **esp)
     goto done;
   process_activate ();
 
-  lock_acquire(&filesys_lock);
-
   /* Open executable file. */
   file = filesys_open (file_name);
   if (file == NULL) 
     {
-      lock_release(&filesys_lock);
       printf ("load: %s: open failed\n", file_name);
       goto done; 
     }
   t->run_file = file;
   file_deny_write(file);
-  lock_release(&filesys_lock);
 
   /* Read and verify executable header. */
   if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
@@ -573,6 +722,8 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 	  vme->writable = writable;
 	  vme->is_loaded = false;
 	  vme->vaddr = upage;
+	  vme->swap_slot = BITMAP_ERROR;
+	  vme->cow = NULL;
 
 	  insert_vme(&thread_current()->vm, vme);
 
@@ -630,6 +781,7 @@ setup_stack (void **esp)
 		vme->vaddr = ((uint8_t *) PHYS_BASE) - PGSIZE;
 		vme->writable = true;
 		vme->is_loaded = true;
+		vme->swap_slot = BITMAP_ERROR;
 
 		insert_vme(&thread_current()->vm, vme);
 	    kpage->vme = vme;
@@ -663,14 +815,116 @@ install_page (void *upage, void *kpage, bool writable)
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
 
+/* Reads VME's page from swap into KADDR.  The pages that follow
+   VME in the address space are read in the same transfer, and
+   mapped without their accessed bits set, for as long as they
+   are swapped out to the slots that follow VME's, up to
+   SWAP_CLUSTER pages in all.  Clustered swap-out writes a
+   process's pages in clock order, which is mostly address order,
+   so a process walking its swapped-out memory gets sequential
+   reads instead of one per fault.  Memory is not reclaimed for
+   the extra pages: they are read only into free frames. */
+static void swap_in_around(struct vm_entry *vme, void *kaddr)
+{
+	struct page *pages[SWAP_CLUSTER];
+	void *kaddrs[SWAP_CLUSTER];
+	size_t cnt, i;
+
+	kaddrs[0] = kaddr;
+	for (cnt = 1; cnt < SWAP_CLUSTER; cnt++)
+	{
+		struct vm_entry *next = find_vme(vme->vaddr + cnt * PGSIZE);
+
+		if (next == NULL || next->type != VM_ANON || next->is_loaded
+			|| next->swap_slot != vme->swap_slot + cnt)
+			break;
+		pages[cnt] = try_alloc_page(PAL_USER);
+		if (pages[cnt] == NULL)
+			break;
+		pages[cnt]->vme = next;
+		kaddrs[cnt] = pages[cnt]->kaddr;
+	}
+
+	/* Map the extra pages before their slots are freed, and stop
+	   at the first that cannot be mapped: it and those after it
+	   stay in swap. */
+	for (i = 1; i < cnt; i++)
+		if (!install_page(pages[i]->vme->vaddr, kaddrs[i], pages[i]->vme->writable))
+			break;
+	while (cnt > i)
+		free_page(kaddrs[--cnt]);
+
+	swap_in_multiple(vme->swap_slot, kaddrs, cnt);
+	vme->swap_slot = BITMAP_ERROR;
+
+	for (i = 1; i < cnt; i++)
+	{
+		pages[i]->vme->swap_slot = BITMAP_ERROR;
+		pages[i]->vme->is_loaded = true;
+	}
+}
+
+/* Loads the pages that follow VME, a file-backed page just
+   loaded, for as long as they belong to the same file at the
+   following offsets and are not loaded yet, up to
+   FAULT_AROUND_PAGES pages in all counting VME.  They are mapped
+   without their accessed bits set.  This saves a fault for each
+   page of a program's text and data as it starts up, and of an
+   mmap'd file read straight through.  As with swap read-around,
+   no memory is reclaimed for the extra pages. */
+static void fault_around(struct vm_entry *vme)
+{
+	size_t i;
+
+	for (i = 1; i < fault_around_pages; i++)
+	{
+		struct vm_entry *next = find_vme(vme->vaddr + i * PGSIZE);
+		struct page *page;
+
+		if (next == NULL || next->is_loaded || next->type != vme->type
+			|| next->file != vme->file
+			|| (next->read_bytes > 0 && next->offset != vme->offset + i * PGSIZE))
+			break;
+		if (share_page(next))
+		{
+			if (!share_map(next, false))
+				break;
+			continue;
+		}
+		page = try_alloc_page(PAL_USER);
+		if (page == NULL)
+			break;
+		page->vme = next;
+		if (!load_file(page->kaddr, next)
+			|| !install_page(next->vaddr, page->kaddr, next->writable))
+		{
+			free_page(page->kaddr);
+			break;
+		}
+		next->is_loaded = true;
+	}
+}
+
 bool handle_mm_fault(struct vm_entry *vme)
 {
-	struct page *page = alloc_page(PAL_USER);
-	void *addr = page->kaddr;
+	struct page *page;
+	void *addr;
 	bool success = false;
 
+	if (share_page(vme))
+	{
+		if (!share_map(vme, true))
+			return false;
+		fault_around(vme);
+		return true;
+	}
+
+	page = alloc_page(PAL_USER);
+	if (page == NULL)
+		return false;
+	addr = page->kaddr;
+
 	page->vme = vme;
-	if(addr == NULL) return false;
 
 	switch(vme->type)
 	{
@@ -679,7 +933,7 @@ bool handle_mm_fault(struct vm_entry *vme)
 			success = load_file(addr, vme);
 			break;
 		case VM_ANON :
-			swap_in(vme->swap_slot, addr);
+			swap_in_around(vme, addr);
 			success = true;
 			break;
 		default :
@@ -699,6 +953,8 @@ bool handle_mm_fault(struct vm_entry *vme)
 	}
 
 	vme->is_loaded = true;
+	if (vme->type != VM_ANON)
+		fault_around(vme);
 
 	return true;
 }
@@ -1,14 +1,24 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include <blockstats.h>
+#include <sysstats.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
 #include "threads/vaddr.h"
+#include "devices/block.h"
 #include "devices/shutdown.h"
+#include "devices/timer.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+#include "vm/cow.h"
 #include "vm/page.h"
 #include "vm/frame.h"
 #include "vm/swap.h"
@@ -18,6 +28,11 @@ bool create (const char *file, unsigned initial_size);
 bool remove (const char *file);
 tid_t exec (const char *cmd_line);
 int wait(tid_t tid);
+bool fsync(int fd);
+void sync(void);
+bool msync(int mapid);
+void sysstats(struct sysstats *stats);
+bool blockstats(const char *device, struct blockstats *stats);
 
 void 
 halt()
@@ -73,15 +88,12 @@ open(const char *file)
 	{
 		return -1;
 	}
-	lock_acquire(&filesys_lock);
 	f = filesys_open(file);
 	if (f == NULL)
 	{	
-		lock_release(&filesys_lock);
 		return -1;
 	}
 	ret = process_add_file(f);
-	lock_release(&filesys_lock);
 
 	return ret;
 }
@@ -99,7 +111,6 @@ int read (int fd, void *buffer, unsigned size)
 {
 	struct file *f;
 	int res= 0;
-	lock_acquire(&filesys_lock);
 	
 	if (fd == 0)
 	{
@@ -123,7 +134,6 @@ int read (int fd, void *buffer, unsigned size)
 			res = file_read(f,buffer,size);
 		}
 	}
-	lock_release(&filesys_lock);
 	return res;
 }
 
@@ -132,7 +142,6 @@ write(int fd, void *buffer, unsigned size)
 {
 	int res=0;
 	struct file * f;
-	lock_acquire(&filesys_lock);
 	if (fd == 0)
 	{
 		res = -1;
@@ -151,7 +160,6 @@ write(int fd, void *buffer, unsigned size)
 			res = file_write(f,buffer,size);
 		}
 	}
-	lock_release(&filesys_lock);
 	return res;
 }
 
@@ -175,6 +183,57 @@ void close (int fd)
 	process_close_file(fd);
 }
 
+/* Maps the PTSPAN bytes of MF's file at OFFSET to ADDR with a
+   single large page, read in now and resident until unmapped, if
+   mmap_large_pages is set, ADDR is 4 MB aligned and LENGTH, the
+   rest of the file, covers the whole span.  Returns false,
+   having mapped nothing, if it cannot, so the caller can fall
+   back to ordinary pages. */
+static bool mmap_large(struct mmap_file *mf, void *addr, int offset, int length)
+{
+	struct thread *cur = thread_current();
+	void *kaddr, *upage;
+
+	if (!mmap_large_pages || pg_ofs(addr) != 0 || pt_no(addr) != 0
+		|| length < PTSPAN || !is_user_vaddr(addr + PTSPAN - 1))
+		return false;
+	for (upage = addr; upage < addr + PTSPAN; upage += PGSIZE)
+		if (find_vme(upage))
+			return false;
+
+	kaddr = palloc_get_aligned(PAL_USER, PTSPAN / PGSIZE, PTSPAN / PGSIZE);
+	if (kaddr == NULL)
+		return false;
+	if (file_read_at(mf->file, kaddr, PTSPAN, offset) != PTSPAN
+		|| !pagedir_set_large_page(cur->pagedir, addr, kaddr, true))
+	{
+		palloc_free_multiple(kaddr, PTSPAN / PGSIZE);
+		return false;
+	}
+
+	/* Each page still gets a vm_entry, so that lookups and
+	   write-back work as for ordinary pages. */
+	for (upage = addr; upage < addr + PTSPAN; upage += PGSIZE)
+	{
+		struct vm_entry *vme = (struct vm_entry *)malloc(sizeof(struct vm_entry));
+		vme->type = VM_FILE;
+		vme->vaddr = upage;
+		vme->writable = true;
+		vme->file = mf->file;
+		vme->offset = offset;
+		vme->read_bytes = PGSIZE;
+		vme->zero_bytes = 0;
+		vme->is_loaded = true;
+		vme->swap_slot = BITMAP_ERROR;
+		vme->cow = NULL;
+
+		insert_vme(&cur->vm, vme);
+		list_push_back(&mf->vme_list, &vme->mmap_elem);
+		offset += PGSIZE;
+	}
+	return true;
+}
+
 int mmap(int fd, void *addr)
 {
 	struct mmap_file *mf;
@@ -196,6 +255,13 @@ int mmap(int fd, void *addr)
 
 	while (read_byte > 0)
 	{
+		if (mmap_large(mf, addr, offset, read_byte))
+		{
+			addr += PTSPAN;
+			offset += PTSPAN;
+			read_byte -= PTSPAN;
+			continue;
+		}
 		if(find_vme(addr))	return -1;
 
 		struct vm_entry *vme = (struct vm_entry *)malloc(sizeof(struct vm_entry));
@@ -207,6 +273,8 @@ int mmap(int fd, void *addr)
 		vme->read_bytes =  read_byte < PGSIZE ? read_byte : PGSIZE;
 		vme->zero_bytes = PGSIZE - vme->read_bytes;
 		vme->is_loaded = false;
+		vme->swap_slot = BITMAP_ERROR;
+		vme->cow = NULL;
 		
 		insert_vme(&thread_current()->vm, vme);
 		list_push_back(&mf->vme_list, &vme->mmap_elem);
@@ -250,25 +318,124 @@ void munmap(int mapid)
 		}
 	}
 }
+/* Writes back the dirty pages of MMAP_FILE and marks them clean.
+   Like the writeback thread, gathers each run of up to
+   WRITEBACK_CLUSTER adjacent dirty pages from their frames into a
+   kernel buffer, with LRU_LIST_LOCK held so that they stay
+   resident, then writes the run with one call after dropping the
+   lock.  The file system never touches user memory, so it cannot
+   fault on a page that has been evicted meanwhile. */
+static void mmap_writeback(struct mmap_file *mmap_file)
+{
+	struct thread *cur = thread_current();
+	struct vm_entry *first = NULL;   /* First page of the run. */
+	size_t run_bytes = 0, cluster = WRITEBACK_CLUSTER;
+	struct list_elem *e;
+	uint8_t *buf;
+
+	buf = palloc_get_multiple(0, cluster);
+	if (buf == NULL)
+	{
+		cluster = 1;
+		buf = palloc_get_page(PAL_ASSERT);
+	}
+
+	lock_acquire(&lru_list_lock);
+	for (e = list_begin(&mmap_file->vme_list); e != list_end(&mmap_file->vme_list); e = list_next(e))
+	{
+		struct vm_entry *vme = list_entry(e, struct vm_entry, mmap_elem);
+		void *kaddr = vme->is_loaded ? pagedir_get_page(cur->pagedir, vme->vaddr) : NULL;
+		bool dirty;
+
+		/* Reclaim may have cleaned the page and not yet written
+		   it. */
+		if (kaddr != NULL && !pagedir_is_large_page(cur->pagedir, vme->vaddr))
+			frame_wait_writeback(frame_lookup(kaddr));
+		dirty = kaddr != NULL && pagedir_is_dirty(cur->pagedir, vme->vaddr);
+
+		if (first != NULL && (!dirty || vme->vaddr != first->vaddr + run_bytes
+		                      || run_bytes + vme->read_bytes > cluster * PGSIZE))
+		{
+			lock_release(&lru_list_lock);
+			file_write_at(first->file, buf, run_bytes, first->offset);
+			lock_acquire(&lru_list_lock);
+			first = NULL;
+		}
+		if (dirty)
+		{
+			if (first == NULL)
+			{
+				first = vme;
+				run_bytes = 0;
+			}
+			/* Clean before copying, so that a write made from now
+			   on dirties the page again.  All the pages of a large
+			   page share one dirty bit, so that waits until the
+			   end. */
+			if (!pagedir_is_large_page(cur->pagedir, vme->vaddr))
+				pagedir_set_dirty(cur->pagedir, vme->vaddr, false);
+			memcpy(buf + run_bytes, kaddr, vme->read_bytes);
+			run_bytes += vme->read_bytes;
+		}
+	}
+	lock_release(&lru_list_lock);
+	if (first != NULL)
+		file_write_at(first->file, buf, run_bytes, first->offset);
+
+	for (e = list_begin(&mmap_file->vme_list); e != list_end(&mmap_file->vme_list); e = list_next(e))
+	{
+		struct vm_entry *vme = list_entry(e, struct vm_entry, mmap_elem);
+		if (vme->is_loaded && pagedir_is_large_page(cur->pagedir, vme->vaddr))
+			pagedir_set_dirty(cur->pagedir, vme->vaddr, false);
+	}
+	palloc_free_multiple(buf, cluster);
+}
+
+/* Writes back the dirty pages of mapping MAPID and then flushes
+   its file to disk, like fsync().  Returns false if there is no
+   such mapping. */
+bool msync(int mapid)
+{
+	struct list_elem *e;
+
+	for (e = list_begin(&thread_current()->mmap_list); e != list_end(&thread_current()->mmap_list); e = list_next(e))
+	{
+		struct mmap_file *f = list_entry (e, struct mmap_file, elem);
+		if (f->mapid == mapid)
+		{
+			mmap_writeback(f);
+			inode_flush(file_get_inode(f->file));
+			return true;
+		}
+	}
+	return false;
+}
+
 void do_munmap(struct mmap_file *mmap_file)
 {
 	ASSERT(mmap_file != NULL);
 	struct thread* cur = thread_current();
 
 	struct list_elem *e;
+	mmap_writeback(mmap_file);
 	for (e = list_begin(&mmap_file->vme_list); e != list_end(&mmap_file->vme_list);)
 	{
 		struct vm_entry *vme = list_entry(e, struct vm_entry, mmap_elem);
 		if(vme->is_loaded)
 		{
-			if (pagedir_is_dirty(cur->pagedir, vme->vaddr))
+			if (pagedir_is_large_page(cur->pagedir, vme->vaddr))
+			{
+				/* A large page's entries are in address order:
+				   free it at the last one. */
+				if (pt_no(vme->vaddr) == PTSPAN / PGSIZE - 1)
+					palloc_free_multiple(pagedir_clear_large_page(cur->pagedir, vme->vaddr),
+						PTSPAN / PGSIZE);
+			}
+			else
 			{
-				lock_acquire(&filesys_lock);
-				file_write_at(vme->file,vme->vaddr,vme->read_bytes,vme->offset);
-				lock_release(&filesys_lock);
+				free_vme_page(vme);
+				pagedir_clear_page(cur->pagedir, vme->vaddr);
 			}
-			free_page(pagedir_get_page(cur->pagedir, vme->vaddr));
-			pagedir_clear_page(cur->pagedir, vme->vaddr);
 		}
 		e = list_remove(e);
 		delete_vme (&cur->vm, vme);
@@ -334,6 +501,45 @@ int inumber(int fd)
 	return inode_get_inumber(file_get_inode(file));
 }
 
+bool fsync(int fd)
+{
+	struct file *file = process_get_file(fd);
+	if(file == NULL)	return false;
+	inode_flush(file_get_inode(file));
+	return true;
+}
+
+void sync(void)
+{
+	filesys_sync();
+}
+
+void sysstats(struct sysstats *stats)
+{
+	void *base;
+
+	stats->ticks = timer_ticks();
+	stats->timer_freq = TIMER_FREQ;
+	block_get_stats(fs_device, &stats->fs_reads, &stats->fs_writes);
+	stats->user_pages = palloc_user_pool(&base);
+	stats->user_free_pages = palloc_user_free_cnt();
+}
+
+/* DEVICE names a block device ("hda") or a role ("filesys"). */
+bool blockstats(const char *device, struct blockstats *stats)
+{
+	struct block *block = block_get_by_name(device);
+	int role;
+
+	for (role = 0; block == NULL && role < BLOCK_ROLE_CNT; role++)
+		if (!strcmp(device, block_type_name(role)))
+			block = block_get_role(role);
+	if (block == NULL)
+		return false;
+	block_get_blockstats(block, stats);
+	return true;
+}
+
 void check_valid_buffer (void *buffer, unsigned size, void *esp, bool to_write)
 {
 	unsigned i;
@@ -350,6 +556,9 @@ void check_valid_buffer (void *buffer, unsigned size, void *esp, bool to_write)
 			{
 				exit(-1);
 			}
+			/* Copy now rather than fault in the middle of the call. */
+			if (vme->cow != NULL && !cow_break(vme))
+				exit(-1);
 		}
 		temp++;
 	}
@@ -390,7 +599,6 @@ get_argument (void *esp, int *arg, int count)
 void
 syscall_init (void) 
 {
-  lock_init(&filesys_lock);
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
@@ -490,5 +698,30 @@ syscall_handler (struct intr_frame *f UNUSED)
 		get_argument(esp,arg,1);
 		f->eax = inumber((int)arg[0]);
 		break;
+	case SYS_FSYNC:
+		get_argument(esp,arg,1);
+		f->eax = fsync((int)arg[0]);
+		break;
+	case SYS_SYNC:
+		sync();
+		break;
+	case SYS_SYSSTATS:
+		get_argument(esp,arg,1);
+		check_valid_buffer((void *)arg[0], sizeof (struct sysstats), esp, true);
+		sysstats((struct sysstats *)arg[0]);
+		break;
+	case SYS_BLOCKSTATS:
+		get_argument(esp,arg,2);
+		check_valid_string((void *)arg[0], esp);
+		check_valid_buffer((void *)arg[1], sizeof (struct blockstats), esp, true);
+		f->eax = blockstats((const char *)arg[0], (struct blockstats *)arg[1]);
+		break;
+	case SYS_FORK:
+		f->eax = process_fork(f);
+		break;
+	case SYS_MSYNC:
+		get_argument(esp,arg,1);
+		f->eax = msync(arg[0]);
+		break;
   }
 }
@@ -15,6 +15,4 @@ void exit(int status);
 struct vm_entry *check_address (void *addr,void* esp);
 void get_argument (void *esp, int *arg, int count);
 
-struct lock filesys_lock;
-
 #endif /* userprog/syscall.h */
@@ -0,0 +1,180 @@
+#include "vm/cow.h"
+#include <debug.h>
+#include <list.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+
+/* Copy-on-write frames.
+
+   fork() gives the child the parent's resident private pages
+   without copying them: the frame is mapped read-only into both
+   page directories, and the first process to write to it gets a
+   copy of its own.  Once only one mapping is left, that process
+   takes the frame back as an ordinary private page.
+
+   A frame shared this way is off the clock list, so it stays
+   resident until it goes back to being private.  If such frames
+   leave reclaim nothing to evict, alloc_page() fails, and the
+   fork or the write that needed a page fails with it.
+   Everything here runs under LRU_LIST_LOCK. */
+
+/* A frame shared copy-on-write. */
+struct cow_frame
+{
+	void *kaddr;                /* The frame. */
+	struct list maps;           /* vm_entries mapping it, by cow_elem. */
+};
+
+/* Gives the frame of COW, now mapped by a single process, back
+   to that process as a private page, and frees COW. */
+static void adopt(struct cow_frame *cow)
+{
+	struct vm_entry *vme = list_entry(list_front(&cow->maps), struct vm_entry, cow_elem);
+	struct page *p = frame_lookup(cow->kaddr);
+
+	ASSERT(list_size(&cow->maps) == 1);
+
+	p->kaddr = cow->kaddr;
+	p->vme = vme;
+	p->thread = vme->cow_thread;
+	add_page_to_lru_list(p);
+	if (vme->writable)
+		pagedir_set_writable(p->thread->pagedir, vme->vaddr, true);
+
+	vme->cow = NULL;
+	free(cow);
+}
+
+/* Maps the page of PVME, resident in PARENT, into the current
+   process at VME, a copy of PVME, copy-on-write.  Returns true if
+   successful. */
+bool cow_share(struct thread *parent, struct vm_entry *pvme, struct vm_entry *vme)
+{
+	struct cow_frame *cow;
+	void *kaddr;
+	bool success;
+
+	lock_acquire(&lru_list_lock);
+	if (!pvme->is_loaded)
+	{
+		/* Evicted since the caller looked. */
+		lock_release(&lru_list_lock);
+		return false;
+	}
+
+	kaddr = pagedir_get_page(parent->pagedir, pvme->vaddr);
+	cow = pvme->cow;
+	if (cow == NULL)
+	{
+		struct page *p = frame_lookup(kaddr);
+
+		cow = malloc(sizeof *cow);
+		if (cow == NULL)
+		{
+			lock_release(&lru_list_lock);
+			return false;
+		}
+		cow->kaddr = kaddr;
+		list_init(&cow->maps);
+
+		/* A modified executable page no longer matches its file,
+		   so it must go to swap from now on. */
+		if (pvme->type == VM_BIN && pagedir_is_dirty(parent->pagedir, pvme->vaddr))
+		{
+			pvme->type = VM_ANON;
+			pvme->swap_slot = BITMAP_ERROR;
+		}
+
+		del_page_from_lru_list(p);
+		p->kaddr = NULL;
+		p->vme = NULL;
+		pagedir_set_writable(parent->pagedir, pvme->vaddr, false);
+		pvme->cow = cow;
+		pvme->cow_thread = parent;
+		list_push_back(&cow->maps, &pvme->cow_elem);
+	}
+
+	success = pagedir_set_page(thread_current()->pagedir, vme->vaddr, kaddr, false);
+	if (success)
+	{
+		vme->type = pvme->type;
+		vme->is_loaded = true;
+		vme->cow = cow;
+		vme->cow_thread = thread_current();
+		list_push_back(&cow->maps, &vme->cow_elem);
+	}
+	else if (list_size(&cow->maps) == 1)
+		adopt(cow);
+	lock_release(&lru_list_lock);
+	return success;
+}
+
+/* Handles a write by the current process to VME, a page it maps
+   copy-on-write: gives it a private copy of the frame, or the
+   frame itself if no other process maps it any more.  Returns
+   false if no page could be allocated for the copy. */
+bool cow_break(struct vm_entry *vme)
+{
+	struct page *page = NULL;
+	struct cow_frame *cow;
+	bool need_page = vme->cow != NULL && list_size(&vme->cow->maps) > 1;
+
+	/* Allocate first: eviction needs LRU_LIST_LOCK. */
+	if (need_page)
+	{
+		page = alloc_page(PAL_USER);
+		if (page == NULL)
+			return false;
+	}
+
+	lock_acquire(&lru_list_lock);
+	cow = vme->cow;
+	if (cow != NULL && list_size(&cow->maps) == 1)
+		adopt(cow);
+	else if (cow != NULL && page != NULL)
+	{
+		uint32_t *pd = thread_current()->pagedir;
+
+		memcpy(page->kaddr, cow->kaddr, PGSIZE);
+		list_remove(&vme->cow_elem);
+		vme->cow = NULL;
+		pagedir_clear_page(pd, vme->vaddr);
+		pagedir_set_page(pd, vme->vaddr, page->kaddr, vme->writable);
+		page->vme = vme;
+		page = NULL;
+		if (list_size(&cow->maps) == 1)
+			adopt(cow);
+	}
+	else if (cow != NULL)
+	{
+		/* Shared again by a fork since we looked. */
+		lock_release(&lru_list_lock);
+		return cow_break(vme);
+	}
+	if (page != NULL)
+		__free_page(page);
+	lock_release(&lru_list_lock);
+	return true;
+}
+
+/* If the current process maps VME's page copy-on-write, unmaps
+   it and returns true.  Otherwise returns false. */
+bool cow_unmap(struct vm_entry *vme)
+{
+	struct cow_frame *cow;
+
+	lock_acquire(&lru_list_lock);
+	cow = vme->cow;
+	if (cow != NULL)
+	{
+		list_remove(&vme->cow_elem);
+		vme->cow = NULL;
+		pagedir_clear_page(thread_current()->pagedir, vme->vaddr);
+		if (list_size(&cow->maps) == 1)
+			adopt(cow);
+	}
+	lock_release(&lru_list_lock);
+	return cow != NULL;
+}
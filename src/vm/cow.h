@@ -0,0 +1,12 @@
+#ifndef VM_COW_H
+#define VM_COW_H
+
+#include <stdbool.h>
+#include "threads/thread.h"
+#include "vm/page.h"
+
+bool cow_share(struct thread *parent, struct vm_entry *pvme, struct vm_entry *vme);
+bool cow_break(struct vm_entry *vme);
+bool cow_unmap(struct vm_entry *vme);
+
+#endif
@@ -1,20 +1,98 @@
 #include "vm/frame.h"
+#include "vm/share.h"
+#include <stdlib.h>
+#include <string.h>
 #include "userprog/pagedir.h"
 #include "userprog/syscall.h"
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Accessed bits kept in a page's age under the aging policy: a
+   page becomes a victim once the clock has passed it this many
+   times without its being accessed. */
+#define AGE_BITS 4
+
+/* Page replacement policies, chosen with -vmpolicy. */
+enum reclaim_policy
+{
+	POLICY_CLOCK,       /* Second chance on the accessed bit. */
+	POLICY_AGING        /* Age counter, preferring clean victims. */
+};
+static enum reclaim_policy reclaim_policy = POLICY_CLOCK;
+
+/* Frame table: one entry for each page of the user pool, indexed
+   by physical frame number less BASE_PFN.  An entry whose KADDR
+   is null is free. */
+static struct page *frame_table;
+static size_t frame_cnt;
+static uintptr_t base_pfn;
+
+/* Reclaim thread state.  The thread keeps the number of free user
+   frames between LOW_WATER and HIGH_WATER. */
+static size_t low_water, high_water;
+static struct semaphore reclaim_sema;   /* Upped to wake the thread. */
+static bool reclaim_active;             /* Woken and not yet done? */
+
+/* Seconds between passes of the writeback thread, or 0 to run
+   none.  Set by the -writeback kernel option. */
+unsigned writeback_secs = 0;
+static uint8_t *writeback_buf;          /* Holds a run being written. */
 
 static struct list_elem *get_next_lru_clock(void);
+static thread_func reclaim_thread NO_RETURN;
+static thread_func writeback_thread NO_RETURN;
 
 void lru_list_init()
 {
+	void *base;
+
 	list_init(&lru_list);
 	lock_init(&lru_list_lock);
+	cond_init(&writeback_cond);
 	lru_clock = NULL;
+
+	frame_cnt = palloc_user_pool(&base);
+	base_pfn = vtop(base) >> PGBITS;
+	frame_table = calloc(frame_cnt, sizeof *frame_table);
+	if (frame_table == NULL)
+		PANIC("can't allocate frame table");
+
+	low_water = frame_cnt / 32 + 1;
+	high_water = 2 * low_water;
+	sema_init(&reclaim_sema, 0);
+	reclaim_active = false;
+	thread_create("reclaim", PRI_DEFAULT + 1, reclaim_thread, NULL);
+
+	if (writeback_secs > 0)
+	{
+		writeback_buf = palloc_get_multiple(PAL_ASSERT, WRITEBACK_CLUSTER);
+		thread_create("writeback", PRI_DEFAULT, writeback_thread, NULL);
+	}
+
+	share_init();
+}
+
+/* Returns the frame table entry for KADDR, a page from the user
+   pool. */
+struct page *frame_lookup(void *kaddr)
+{
+	uintptr_t pfn = vtop(kaddr) >> PGBITS;
+
+	ASSERT(pg_ofs(kaddr) == 0);
+	ASSERT(pfn - base_pfn < frame_cnt);
+	return &frame_table[pfn - base_pfn];
 }
 
+/* Adds PAGE to the clock list and, unless it is a shared frame,
+   to its thread's resident pages. */
 void add_page_to_lru_list(struct page *page)
 {
 	list_push_back(&lru_list, &page->lru);
+	if (page->share == NULL)
+		list_push_back(&page->thread->resident_pages, &page->proc_elem);
 }
 
 void del_page_from_lru_list(struct page *page)
@@ -23,6 +101,8 @@ void del_page_from_lru_list(struct page *page)
 		lru_clock = list_remove(&page->lru);
 	else
 		list_remove(&page->lru);
+	if (page->share == NULL)
+		list_remove(&page->proc_elem);
 }
 
 static struct list_elem *get_next_lru_clock(void)
@@ -45,51 +125,393 @@ static struct list_elem *get_next_lru_clock(void)
 	return lru_clock;
 }
 
-void* try_to_free_pages(enum palloc_flags flags)
+/* Returns true if evicting P requires writing it to swap. */
+static bool needs_swap(struct page *p)
 {
-	void *kaddr;
-	struct list_elem *e;
+	return p->vme->type == VM_ANON
+		|| (p->vme->type == VM_BIN
+			&& pagedir_is_dirty(p->thread->pagedir, p->vme->vaddr));
+}
+
+/* Returns true if evicting P requires writing it anywhere, to
+   swap or to its file. */
+static bool is_dirty(struct page *p)
+{
+	return needs_swap(p)
+		|| (p->vme->type == VM_FILE
+			&& pagedir_is_dirty(p->thread->pagedir, p->vme->vaddr));
+}
+
+/* Selects the page replacement policy named NAME, "clock" or
+   "aging".  Returns false if there is no such policy. */
+bool reclaim_set_policy(const char *name)
+{
+	if (!strcmp(name, "clock"))
+		reclaim_policy = POLICY_CLOCK;
+	else if (!strcmp(name, "aging"))
+		reclaim_policy = POLICY_AGING;
+	else
+		return false;
+	return true;
+}
+
+/* Clock policy: returns true if P may be evicted because it has
+   not been accessed since the clock last passed it.  Otherwise
+   clears its accessed bit, giving it a second chance. */
+static bool clock_select(struct page *p)
+{
+	if(pagedir_is_accessed(p->thread->pagedir, p->vme->vaddr))
+	{
+		pagedir_set_accessed(p->thread->pagedir, p->vme->vaddr, false);
+		return false;
+	}
+	return true;
+}
+
+/* Aging policy: shifts P's accessed bit into its age, clearing
+   the bit, and returns true if P may be evicted because its age
+   is then zero.  A dirty page, which costs a write to evict, is
+   passed over instead, unless *DEFERRED, the count of dirty pages
+   passed over so far, has reached LIMIT, so that clean pages go
+   first but a memory full of dirty pages still makes progress. */
+static bool aging_select(struct page *p, size_t *deferred, size_t limit)
+{
+	bool accessed = pagedir_is_accessed(p->thread->pagedir, p->vme->vaddr);
+
+	if (accessed)
+		pagedir_set_accessed(p->thread->pagedir, p->vme->vaddr, false);
+	p->age = (p->age >> 1) | (accessed ? 1 << (AGE_BITS - 1) : 0);
+	if (p->age != 0)
+		return false;
+	if (*deferred < limit && is_dirty(p))
+	{
+		++*deferred;
+		return false;
+	}
+	return true;
+}
+
+/* Writes the CNT pages in CLUSTER to swap, in one transfer if
+   enough consecutive slots are free, and frees them.  The pages
+   are copied aside and freed with LRU_LIST_LOCK held, which is
+   then dropped for the disk write.  A page that gets no slot
+   because swap is full stays resident and on the clock list.
+   Returns the number of pages freed. */
+static size_t swap_out_cluster(struct page **cluster, size_t cnt)
+{
+	void *kaddrs[SWAP_CLUSTER];
+	size_t slots[SWAP_CLUSTER];
+	size_t i, freed = 0;
+
+	for (i = 0; i < cnt; i++)
+		kaddrs[i] = cluster[i]->kaddr;
+	swap_out_begin(kaddrs, cnt, slots);
+
+	for (i = 0; i < cnt; i++)
+	{
+		struct page *p = cluster[i];
+
+		if (slots[i] == BITMAP_ERROR)
+			continue;
+		p->vme->type = VM_ANON;
+		p->vme->swap_slot = slots[i];
+		p->vme->is_loaded = false;
+		__free_page(p);
+		freed++;
+	}
+
+	lock_release(&lru_list_lock);
+	swap_out_end();
 	lock_acquire(&lru_list_lock);
+	return freed;
+}
+
+/* Writes dirty file-backed page P to its file and marks it clean,
+   leaving it resident to be evicted on a later lap.  P is copied
+   to a bounce page and pinned by its WRITEBACK flag with
+   LRU_LIST_LOCK held, which is dropped for the write.  munmap
+   waits for the flag to clear, so P's mapping and file outlive
+   the write.  Returns false if no bounce page was free. */
+static bool writeback_page(struct page *p)
+{
+	struct vm_entry *vme = p->vme;
+	void *buf = palloc_get_page(0);
 
-	while(true)
+	if (buf == NULL)
+		return false;
+
+	/* Clean before copying, so that a write made from now on
+	   dirties the page again. */
+	pagedir_set_dirty(p->thread->pagedir, vme->vaddr, false);
+	memcpy(buf, p->kaddr, vme->read_bytes);
+	p->writeback = true;
+
+	lock_release(&lru_list_lock);
+	file_write_at(vme->file, buf, vme->read_bytes, vme->offset);
+	palloc_free_page(buf);
+	lock_acquire(&lru_list_lock);
+
+	p->writeback = false;
+	cond_broadcast(&writeback_cond, &lru_list_lock);
+	return true;
+}
+
+/* Waits until reclaim is not writing PAGE to its file.  Must be
+   called with LRU_LIST_LOCK held. */
+void frame_wait_writeback(struct page *page)
+{
+	ASSERT(lock_held_by_current_thread(&lru_list_lock));
+
+	while (page->writeback)
+		cond_wait(&writeback_cond, &lru_list_lock);
+}
+
+/* Runs the clock, evicting pages, until a page can be allocated
+   with FLAGS, which is returned, or, if TARGET is nonzero, until
+   TARGET user frames are free, returning a null pointer.  Gives
+   up, returning a null pointer, if the clock finds nothing to
+   evict.  Victims are chosen by the current policy.  Pages that
+   must go to swap are not written one at a time: up to
+   SWAP_CLUSTER of them are gathered and written to consecutive
+   slots together.  Once swap fills up, such pages are passed
+   over for the rest of the pass, so that a memory full of them
+   makes reclaim give up rather than lose their contents.  Must
+   be called with LRU_LIST_LOCK held, which is dropped around
+   each write, to swap or to a file. */
+static void *reclaim(enum palloc_flags flags, size_t target)
+{
+	struct page *cluster[SWAP_CLUSTER];
+	size_t lru_cnt = list_size(&lru_list);
+	size_t cnt = 0, idle = 0, deferred = 0, max_idle;
+	bool swap_full = false;
+	void *kaddr = NULL;
+
+	/* Without an eviction, the clock policy takes two laps to
+	   clear every accessed bit, and aging takes AGE_BITS laps to
+	   age every page to zero and one more to pass over dirty
+	   pages.  One more lap after that means every page is
+	   pinned. */
+	max_idle = (reclaim_policy == POLICY_AGING ? AGE_BITS + 2 : 3) * lru_cnt;
+
+	for (;;)
 	{
-		e = get_next_lru_clock();
-		struct page *p = list_entry(e, struct page, lru);
+		struct list_elem *e = get_next_lru_clock();
+		struct page *p;
+		size_t i;
+
+		if (e == NULL || idle++ > max_idle)
+			break;
+		p = list_entry(e, struct page, lru);
 
-		if(pagedir_is_accessed(p->thread->pagedir, p->vme->vaddr))
+		/* Back at a gathered page: write out the cluster. */
+		for (i = 0; i < cnt; i++)
+			if (cluster[i] == p)
+				break;
+		if (i < cnt)
 		{
-			pagedir_set_accessed(p->thread->pagedir, p->vme->vaddr, false);
+			size_t freed = swap_out_cluster(cluster, cnt);
+
+			swap_full = freed < cnt;
+			cnt = 0;
+			if (freed == 0)
+				continue;
 		}
-		else
+		else if (p->share != NULL)
 		{
-			switch(p->vme->type)
+			/* Shared text: no write needed. */
+			if (!share_evict(p))
+				continue;
+		}
+		else if (p->vme == NULL || !p->vme->is_loaded || p->writeback)
+		{
+			/* Still being loaded, or being written: pinned. */
+			continue;
+		}
+		else if (reclaim_policy == POLICY_AGING
+				? !aging_select(p, &deferred, lru_cnt)
+				: !clock_select(p))
+		{
+			continue;
+		}
+		else if(needs_swap(p))
+		{
+			size_t freed;
+
+			if (swap_full)
+				continue;
+			cluster[cnt++] = p;
+			if (cnt < SWAP_CLUSTER)
+				continue;
+			freed = swap_out_cluster(cluster, cnt);
+			swap_full = freed < cnt;
+			cnt = 0;
+			if (freed == 0)
+				continue;
+		}
+		else if(p->vme->type == VM_FILE && pagedir_is_dirty(p->thread->pagedir, p->vme->vaddr))
+		{
+			/* Gathered pages must not be freed under us while the
+			   lock is dropped: write them out first. */
+			if (cnt > 0)
 			{
-				case VM_BIN:
-					if(pagedir_is_dirty(p->thread->pagedir, p->vme->vaddr))
-					{
-						p->vme->type = VM_ANON;
-						p->vme->swap_slot = swap_out(p->kaddr);
-					}
-					break;
-				case VM_FILE:
-					if(pagedir_is_dirty(p->thread->pagedir, p->vme->vaddr))
-					{
-						lock_acquire(&filesys_lock);
-						file_write_at(p->vme->file, p->vme->vaddr, p->vme->read_bytes, p->vme->offset);
-						lock_release(&filesys_lock);
-					}
-					break;
-				case VM_ANON:
-					p->vme->swap_slot = swap_out(p->kaddr);
-					break;
+				swap_full = swap_out_cluster(cluster, cnt) < cnt;
+				cnt = 0;
 			}
+			if (!writeback_page(p))
+				continue;
+		}
+		else
+		{
 			p->vme->is_loaded = false;
 			__free_page(p);
+		}
 
+		idle = 0;
+		if (target == 0)
+		{
 			kaddr = palloc_get_page(flags);
-			if(kaddr)	break;
+			if (kaddr != NULL)
+				break;
 		}
+		else if (palloc_user_free_cnt() >= target)
+			break;
 	}
+
+	/* Pages gathered before the goal was reached go out too, and
+	   may yet make room for the page wanted. */
+	if (cnt > 0 && swap_out_cluster(cluster, cnt) > 0 && target == 0 && kaddr == NULL)
+		kaddr = palloc_get_page(flags);
+	return kaddr;
+}
+
+/* Evicts pages until one can be allocated with FLAGS, and
+   returns it, or a null pointer if nothing could be evicted.
+   This is direct reclaim, for when the reclaim thread has not
+   kept up. */
+void* try_to_free_pages(enum palloc_flags flags)
+{
+	void *kaddr;
+
+	reclaim_wake();
+	lock_acquire(&lru_list_lock);
+	kaddr = reclaim(flags, 0);
 	lock_release(&lru_list_lock);
 	return kaddr;
 }
+
+/* Wakes the reclaim thread if free user frames are below the low
+   watermark. */
+void reclaim_wake(void)
+{
+	if (!reclaim_active && palloc_user_free_cnt() < low_water)
+	{
+		reclaim_active = true;
+		sema_up(&reclaim_sema);
+	}
+}
+
+/* Reclaim thread.  Each time free user frames drop below the low
+   watermark, runs the clock until they are back up to the high
+   watermark, so that page faults usually find a free frame and do
+   not wait for eviction and write-back themselves. */
+static void reclaim_thread(void *aux UNUSED)
+{
+	for (;;)
+	{
+		sema_down(&reclaim_sema);
+		lock_acquire(&lru_list_lock);
+		reclaim(PAL_USER, high_water);
+		lock_release(&lru_list_lock);
+		reclaim_active = false;
+	}
+}
+
+/* Returns true if P is a resident file-backed page with changes
+   not yet written to its file. */
+static bool writeback_needed(struct page *p)
+{
+	return p->vme != NULL && p->vme->is_loaded && p->vme->type == VM_FILE
+		&& !p->writeback && pagedir_is_dirty(p->thread->pagedir, p->vme->vaddr);
+}
+
+/* Orders pointers to pages by file, then by offset in the file. */
+static int writeback_cmp(const void *a_, const void *b_)
+{
+	const struct vm_entry *a = (*(struct page *const *) a_)->vme;
+	const struct vm_entry *b = (*(struct page *const *) b_)->vme;
+
+	if (a->file != b->file)
+		return (uintptr_t) a->file < (uintptr_t) b->file ? -1 : 1;
+	return a->offset < b->offset ? -1 : a->offset > b->offset;
+}
+
+/* Writes back every dirty file-backed page on the clock list and
+   marks it clean.  The pages are sorted by file and offset, and
+   each run of up to WRITEBACK_CLUSTER adjacent ones is gathered
+   into WRITEBACK_BUF and written with one call.  Must be called
+   with LRU_LIST_LOCK held.  The pages are pinned by their
+   WRITEBACK flags, so that they stay resident while the lock is
+   dropped around each write. */
+static void writeback_dirty(void)
+{
+	struct page **dirty;
+	size_t cnt = 0, i, j;
+	struct list_elem *e;
+
+	dirty = malloc(list_size(&lru_list) * sizeof *dirty);
+	if (dirty == NULL)
+		return;
+	for (e = list_begin(&lru_list); e != list_end(&lru_list); e = list_next(e))
+	{
+		struct page *p = list_entry(e, struct page, lru);
+		if (writeback_needed(p))
+		{
+			p->writeback = true;
+			dirty[cnt++] = p;
+		}
+	}
+	qsort(dirty, cnt, sizeof *dirty, writeback_cmp);
+
+	for (i = 0; i < cnt; i = j)
+	{
+		struct vm_entry *first = dirty[i]->vme;
+		size_t bytes = 0;
+
+		for (j = i; j < cnt && j - i < WRITEBACK_CLUSTER; j++)
+		{
+			struct page *p = dirty[j];
+
+			if (p->vme->file != first->file || p->vme->offset != first->offset + bytes)
+				break;
+
+			/* Clean before copying, so that a write made from now
+			   on dirties the page again. */
+			pagedir_set_dirty(p->thread->pagedir, p->vme->vaddr, false);
+			memcpy(writeback_buf + bytes, p->kaddr, p->vme->read_bytes);
+			bytes += p->vme->read_bytes;
+		}
+
+		lock_release(&lru_list_lock);
+		file_write_at(first->file, writeback_buf, bytes, first->offset);
+		lock_acquire(&lru_list_lock);
+		while (i < j)
+			dirty[i++]->writeback = false;
+		cond_broadcast(&writeback_cond, &lru_list_lock);
+	}
+	free(dirty);
+}
+
+/* Writeback thread.  Every WRITEBACK_SECS seconds, writes back
+   dirty pages of mapped files, so that changes reach the file
+   system without waiting for munmap or eviction, and so that
+   those find less to write. */
+static void writeback_thread(void *aux UNUSED)
+{
+	for (;;)
+	{
+		timer_sleep((int64_t) writeback_secs * TIMER_FREQ);
+		lock_acquire(&lru_list_lock);
+		writeback_dirty();
+		lock_release(&lru_list_lock);
+	}
+}
@@ -5,13 +5,25 @@
 #include "vm/page.h"
 #include "vm/swap.h"
 
+/* Most file-backed pages gathered into one write by the writeback
+   thread and by msync and munmap. */
+#define WRITEBACK_CLUSTER 8
+
 void lru_list_init(void);
+struct page *frame_lookup(void *kaddr);
 void add_page_to_lru_list(struct page *page);
-void del_page_to_lru_list(struct page *page);
+void del_page_from_lru_list(struct page *page);
 void* try_to_free_pages(enum palloc_flags flags);
+void reclaim_wake(void);
+bool reclaim_set_policy(const char *name);
+
+extern unsigned writeback_secs;
 
 struct list lru_list;
 struct lock lru_list_lock;
 struct list_elem *lru_clock;
+struct condition writeback_cond;
+
+void frame_wait_writeback(struct page *page);
 
 #endif
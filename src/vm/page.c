@@ -1,11 +1,22 @@
 #include "vm/page.h"
 #include "vm/frame.h"
+#include "vm/cow.h"
+#include "vm/share.h"
 #include "vm/swap.h"
 #include "threads/vaddr.h"
 #include "userprog/pagedir.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 
+/* Most pages loaded by one fault on a file-backed page, set by
+   the -faultaround kernel option. */
+size_t fault_around_pages = 8;
+
+/* If true, mmap() maps each aligned 4 MB span of a file with a
+   single large page, read in at once.  Set by the -largepages
+   kernel option. */
+bool mmap_large_pages = false;
+
 static unsigned vm_hash_func (const struct hash_elem *e, void *aux)
 {
 	ASSERT(e != NULL);
@@ -54,10 +65,17 @@ void vm_destroy_func(struct hash_elem *e, void *aux UNUSED)
 {
 	ASSERT(e != NULL);
 	struct vm_entry *vme = hash_entry(e, struct vm_entry, elem);
-	if(vme->is_loaded)
+	if(share_page(vme))
+	{
+		share_put(vme);
+	}
+	else if(vme->is_loaded && !cow_unmap(vme))
+	{
+		free_vme_page(vme);
+	}
+	else if(vme->type == VM_ANON && !vme->is_loaded && vme->swap_slot != BITMAP_ERROR)
 	{
-		palloc_free_page(pagedir_get_page(thread_current()->pagedir, vme->vaddr));
-		pagedir_clear_page(thread_current()->pagedir, vme->vaddr);
+		swap_free(vme->swap_slot);
 	}
 	free(vme);
 }
@@ -79,47 +97,124 @@ bool load_file(void *kaddr, struct vm_entry *vme)
 	return true;
 }
 
-struct page* alloc_page(enum palloc_flags flags)
+/* Sets up and returns the frame table entry for KADDR, a newly
+   allocated user page. */
+static struct page *add_frame(void *kaddr)
 {
-	struct page *p = (struct page *)malloc(sizeof(struct page));
-	if(p == NULL)	return NULL;
+	struct page *p;
 
-	p->thread = thread_current();
-	p->kaddr = NULL;
+	p = frame_lookup(kaddr);
+	p->kaddr = kaddr;
 	p->vme = NULL;
-	p->kaddr = palloc_get_page(flags);
-	while (p->kaddr == NULL)
-	{
-		p->kaddr = try_to_free_pages(flags);
-	}
-	
+	p->thread = thread_current();
+	p->age = 0;
+	p->writeback = false;
+	p->share = NULL;
+
 	lock_acquire(&lru_list_lock);
 	add_page_to_lru_list(p);
 	lock_release(&lru_list_lock);
 	return p;
 }
 
+/* Allocates a user page, evicting another if memory is full, and
+   returns its frame table entry.  Returns a null pointer if
+   nothing can be evicted, as when every resident page is pinned
+   or shared copy-on-write, rather than waiting for a page that
+   may never come free. */
+struct page* alloc_page(enum palloc_flags flags)
+{
+	void *kaddr;
+
+	ASSERT(flags & PAL_USER);
+	kaddr = palloc_get_page(flags);
+	if (kaddr == NULL)
+	{
+		kaddr = try_to_free_pages(flags);
+		if (kaddr == NULL)
+			return NULL;
+	}
+	reclaim_wake();
+	return add_frame(kaddr);
+}
+
+/* Like alloc_page(), but returns a null pointer instead of
+   evicting a page if memory is full. */
+struct page *try_alloc_page(enum palloc_flags flags)
+{
+	void *kaddr;
+
+	ASSERT(flags & PAL_USER);
+	kaddr = palloc_get_page(flags);
+	return kaddr != NULL ? add_frame(kaddr) : NULL;
+}
+
+/* Frees KADDR, a page from alloc_page() that reclaim cannot
+   have evicted because it is still being loaded, unless it is
+   null.  See free_vme_page() for a page found through the page
+   table. */
 void free_page(void *kaddr)
 {
-	struct list_elem *e;
+	struct page *p;
+
+	if (kaddr == NULL)
+		return;
+	lock_acquire(&lru_list_lock);
+	p = frame_lookup(kaddr);
+	if(p->kaddr == kaddr)
+	{
+		__free_page(p);
+	}
+	lock_release(&lru_list_lock);
+}
+
+/* Frees the page in which VME, an entry of the current process,
+   is resident, unless it has been evicted.  The page table is
+   read with LRU_LIST_LOCK held, so that reclaim cannot evict the
+   page and hand its frame to another process in between, and the
+   frame must still belong to VME. */
+void free_vme_page(struct vm_entry *vme)
+{
+	void *kaddr;
+
 	lock_acquire(&lru_list_lock);
-	for(e = list_begin(&lru_list); e != list_end(&lru_list); e = list_next(e))
+	kaddr = vme->is_loaded ? pagedir_get_page(thread_current()->pagedir, vme->vaddr) : NULL;
+	if (kaddr != NULL)
 	{
-		struct page *p = list_entry(e, struct page, lru);
-		if(p->kaddr == kaddr)
-		{
+		struct page *p = frame_lookup(kaddr);
+		if (p->kaddr == kaddr && p->vme == vme)
 			__free_page(p);
-			break;
-		}
 	}
 	lock_release(&lru_list_lock);
 }
 
+/* Frees every page resident for the current process, in time
+   proportional to their number rather than to all resident
+   pages.  Swap is left alone: a page that is resident has no
+   swap slot. */
+void free_resident_pages(void)
+{
+	struct list *pages = &thread_current()->resident_pages;
+
+	lock_acquire(&lru_list_lock);
+	while (!list_empty(pages))
+	{
+		struct page *p = list_entry(list_front(pages), struct page, proc_elem);
+		if (p->vme != NULL)
+			p->vme->is_loaded = false;
+		__free_page(p);
+	}
+	lock_release(&lru_list_lock);
+}
+
+/* Unmaps and frees PAGE.  Must be called with LRU_LIST_LOCK
+   held. */
 void __free_page(struct page *page)
 {
 	ASSERT(page != NULL);
-	pagedir_clear_page(page->thread->pagedir, page->vme->vaddr);
+	if (page->vme != NULL)
+		pagedir_clear_page(page->thread->pagedir, page->vme->vaddr);
 	del_page_from_lru_list(page);
 	palloc_free_page(page->kaddr);
-	free(page);
+	page->kaddr = NULL;
 }
@@ -26,7 +26,14 @@ struct vm_entry
 	size_t read_bytes;
 	size_t zero_bytes;
 
-	size_t swap_slot;
+	size_t swap_slot;               /* Slot holding the page, or BITMAP_ERROR. */
+
+	struct cow_frame *cow;          /* Frame shared copy-on-write, or null. */
+	struct list_elem cow_elem;      /* In COW's mappings. */
+	struct thread *cow_thread;      /* Process mapping COW through this. */
+
+	struct list_elem share_elem;    /* In its shared page's mappings. */
+	struct thread *share_thread;    /* Process mapping it through this. */
 
 	struct hash_elem elem;
 };
@@ -39,14 +46,23 @@ struct mmap_file
 	struct list vme_list;
 };
 
+struct shared_page;
+
 struct page
 {
 	void *kaddr;
 	struct vm_entry *vme;
 	struct thread *thread;
 	struct list_elem lru;
+	struct list_elem proc_elem;     /* In thread's resident_pages. */
+	uint8_t age;                    /* Recent accessed bits, for aging. */
+	bool writeback;                 /* Being written to its file by reclaim? */
+	struct shared_page *share;      /* Shared frame, with null VME, or null. */
 };
 
+extern size_t fault_around_pages;
+extern bool mmap_large_pages;
+
 void vm_init(struct hash *vm);
 bool insert_vme(struct hash *vm, struct vm_entry *vme);
 bool delete_vme(struct hash *vm, struct vm_entry *vme);
@@ -55,8 +71,11 @@ void vm_destroy_func(struct hash_elem *e, void *aux);
 void vm_destroy(struct hash *vm);
 bool load_file(void *kaddr, struct vm_entry *vme);
 struct page* alloc_page(enum palloc_flags flags);
+struct page *try_alloc_page(enum palloc_flags flags);
 void free_page(void *kaddr);
+void free_vme_page(struct vm_entry *vme);
 void __free_page(struct page *page);
+void free_resident_pages(void);
 
 
 #endif
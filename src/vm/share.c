@@ -0,0 +1,261 @@
+#include "vm/share.h"
+#include <debug.h>
+#include <hash.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+
+/* Shared read-only executable pages.
+
+   Every process running a program used to get private frames for
+   its code, though they hold the same bytes.  Instead, the frames
+   for read-only VM_BIN pages are kept in a table keyed by the
+   executable's inode and the page's offset in it, with the list
+   of vm_entries that map each one, so that N copies of a program
+   share one copy of its text and read it from disk once.
+
+   A shared frame is on the clock list, with a null VME and its
+   SHARE set, but in no process's resident pages.  Reclaim evicts
+   it by unmapping it from every process at once, which needs no
+   write, since the page is read-only and still in its file.  It
+   is also freed when the last process unmaps it.
+
+   Lock order is SHARE_LOCK, then LRU_LIST_LOCK.  Reclaim holds
+   LRU_LIST_LOCK already, so it only tries for SHARE_LOCK. */
+
+/* A shared frame. */
+struct shared_page
+{
+	struct inode *inode;        /* Executable, kept open by its mappers. */
+	off_t offset;               /* Offset of the page in it. */
+	void *kaddr;                /* The frame, or null while loading. */
+	bool loading;               /* Being read by the thread that added it? */
+	struct list maps;           /* vm_entries mapping it, by share_elem. */
+	struct hash_elem elem;      /* In SHARED_PAGES. */
+};
+
+static struct hash shared_pages;
+static struct lock share_lock;  /* Protects SHARED_PAGES and mappings. */
+static struct condition share_loaded;   /* Signaled when a load ends. */
+
+static unsigned shared_hash(const struct hash_elem *e, void *aux UNUSED)
+{
+	const struct shared_page *s = hash_entry(e, struct shared_page, elem);
+	return hash_bytes(&s->inode, sizeof s->inode) ^ hash_int(s->offset);
+}
+
+static bool shared_less(const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED)
+{
+	const struct shared_page *a = hash_entry(a_, struct shared_page, elem);
+	const struct shared_page *b = hash_entry(b_, struct shared_page, elem);
+	return a->inode != b->inode ? a->inode < b->inode : a->offset < b->offset;
+}
+
+void share_init(void)
+{
+	hash_init(&shared_pages, shared_hash, shared_less, NULL);
+	lock_init(&share_lock);
+	cond_init(&share_loaded);
+}
+
+/* Returns true if VME's page is shared between processes. */
+bool share_page(struct vm_entry *vme)
+{
+	return vme->type == VM_BIN && !vme->writable;
+}
+
+/* Returns the entry for VME's page, or a null pointer if it is
+   not resident.  Must be called with SHARE_LOCK held. */
+static struct shared_page *find_shared(struct vm_entry *vme)
+{
+	struct shared_page key;
+	struct hash_elem *e;
+
+	key.inode = file_get_inode(vme->file);
+	key.offset = vme->offset;
+	e = hash_find(&shared_pages, &key.elem);
+	return e != NULL ? hash_entry(e, struct shared_page, elem) : NULL;
+}
+
+/* Maps S's frame read-only into the current process at VME.
+   Returns true if successful.  Must be called with SHARE_LOCK
+   held, so that reclaim cannot free the frame meanwhile. */
+static bool map_frame(struct shared_page *s, struct vm_entry *vme)
+{
+	struct thread *cur = thread_current();
+
+	if (!pagedir_set_page(cur->pagedir, vme->vaddr, s->kaddr, false))
+		return false;
+	vme->share_thread = cur;
+	vme->is_loaded = true;
+	list_push_back(&s->maps, &vme->share_elem);
+	return true;
+}
+
+/* Removes S, which no process maps any more, from the table and
+   the clock list, and frees it and its frame.  Must be called
+   with SHARE_LOCK and LRU_LIST_LOCK held. */
+static void free_shared(struct shared_page *s)
+{
+	struct page *p = frame_lookup(s->kaddr);
+
+	ASSERT(list_empty(&s->maps));
+
+	hash_delete(&shared_pages, &s->elem);
+	del_page_from_lru_list(p);
+	p->kaddr = NULL;
+	p->share = NULL;
+	palloc_free_page(s->kaddr);
+	free(s);
+}
+
+/* Maps VME's page, a shared page, into the current process.
+   Reads the page from its file if no process has it mapped,
+   evicting a page for it if RECLAIM is true and memory is full.
+   The read is done without SHARE_LOCK: the entry is marked as
+   loading meanwhile, and other processes wanting the page wait
+   for it.  Returns false if the page cannot be read or mapped, or
+   if memory is full and RECLAIM is false. */
+bool share_map(struct vm_entry *vme, bool reclaim)
+{
+	struct shared_page *s;
+	struct page *p;
+	void *kaddr = NULL;
+	bool success;
+
+	ASSERT(share_page(vme));
+
+	lock_acquire(&share_lock);
+	while ((s = find_shared(vme)) != NULL && s->loading)
+		cond_wait(&share_loaded, &share_lock);
+	if (s != NULL)
+	{
+		success = map_frame(s, vme);
+		lock_release(&share_lock);
+		return success;
+	}
+
+	s = malloc(sizeof *s);
+	if (s == NULL)
+	{
+		lock_release(&share_lock);
+		return false;
+	}
+	s->inode = file_get_inode(vme->file);
+	s->offset = vme->offset;
+	s->kaddr = NULL;
+	s->loading = true;
+	list_init(&s->maps);
+	hash_insert(&shared_pages, &s->elem);
+	lock_release(&share_lock);
+
+	kaddr = palloc_get_page(PAL_USER);
+	if (kaddr == NULL && reclaim)
+		kaddr = try_to_free_pages(PAL_USER);
+	reclaim_wake();
+	if (kaddr != NULL && !load_file(kaddr, vme))
+	{
+		palloc_free_page(kaddr);
+		kaddr = NULL;
+	}
+
+	lock_acquire(&share_lock);
+	s->loading = false;
+	cond_broadcast(&share_loaded, &share_lock);
+	if (kaddr == NULL)
+	{
+		hash_delete(&shared_pages, &s->elem);
+		lock_release(&share_lock);
+		free(s);
+		return false;
+	}
+
+	s->kaddr = kaddr;
+	p = frame_lookup(kaddr);
+	p->kaddr = kaddr;
+	p->vme = NULL;
+	p->thread = NULL;
+	p->age = 0;
+	p->writeback = false;
+	p->share = s;
+	lock_acquire(&lru_list_lock);
+	add_page_to_lru_list(p);
+	success = map_frame(s, vme);
+	if (!success)
+		free_shared(s);
+	lock_release(&lru_list_lock);
+	lock_release(&share_lock);
+	return success;
+}
+
+/* Unmaps VME's shared page from the current process, if it is
+   mapped, and frees the frame if no process maps it any more. */
+void share_put(struct vm_entry *vme)
+{
+	struct shared_page *s;
+
+	lock_acquire(&share_lock);
+	if (!vme->is_loaded)
+	{
+		/* Evicted by reclaim. */
+		lock_release(&share_lock);
+		return;
+	}
+	s = find_shared(vme);
+	ASSERT(s != NULL);
+	list_remove(&vme->share_elem);
+	vme->is_loaded = false;
+	pagedir_clear_page(thread_current()->pagedir, vme->vaddr);
+	if (list_empty(&s->maps))
+	{
+		lock_acquire(&lru_list_lock);
+		free_shared(s);
+		lock_release(&lru_list_lock);
+	}
+	lock_release(&share_lock);
+}
+
+/* Called by reclaim, with LRU_LIST_LOCK held, for P, a shared
+   frame the clock has reached.  Gives the frame a second chance
+   if any process has accessed it since the clock last passed,
+   like the clock policy, and otherwise unmaps it everywhere and
+   frees it.  Returns true if the frame was freed. */
+bool share_evict(struct page *p)
+{
+	struct shared_page *s = p->share;
+	bool accessed = false;
+	struct list_elem *e;
+
+	ASSERT(lock_held_by_current_thread(&lru_list_lock));
+
+	if (!lock_try_acquire(&share_lock))
+		return false;
+
+	for (e = list_begin(&s->maps); e != list_end(&s->maps); e = list_next(e))
+	{
+		struct vm_entry *vme = list_entry(e, struct vm_entry, share_elem);
+		uint32_t *pd = vme->share_thread->pagedir;
+
+		if (pagedir_is_accessed(pd, vme->vaddr))
+		{
+			pagedir_set_accessed(pd, vme->vaddr, false);
+			accessed = true;
+		}
+	}
+	if (!accessed)
+	{
+		while (!list_empty(&s->maps))
+		{
+			struct vm_entry *vme = list_entry(list_pop_front(&s->maps), struct vm_entry, share_elem);
+
+			pagedir_clear_page(vme->share_thread->pagedir, vme->vaddr);
+			vme->is_loaded = false;
+		}
+		free_shared(s);
+	}
+	lock_release(&share_lock);
+	return !accessed;
+}
@@ -0,0 +1,13 @@
+#ifndef VM_SHARE_H
+#define VM_SHARE_H
+
+#include <stdbool.h>
+#include "vm/page.h"
+
+void share_init(void);
+bool share_page(struct vm_entry *vme);
+bool share_map(struct vm_entry *vme, bool reclaim);
+void share_put(struct vm_entry *vme);
+bool share_evict(struct page *p);
+
+#endif
@@ -1,56 +1,213 @@
 #include "vm/swap.h"
+#include <string.h>
+#include "threads/palloc.h"
+#include "vm/zswap.h"
 
-int swap_size = 8 * 1024;
+/* Number of swap slots, set from the size of the swap device. */
+static size_t swap_size;
+
+/* Next-fit cursor: the slot after the last ones allocated, where
+   the next search for free slots begins.  Under SWAP_LOCK. */
+static size_t next_slot;
+
+/* Most pages queued for swap_out_end(): a cluster, and as many
+   again spilled from the compressed cache to make room for it. */
+#define OUT_MAX (2 * SWAP_CLUSTER)
+
+/* OUT_MAX pages through which swap_out_begin() and
+   swap_in_multiple() transfer their pages, under SWAP_LOCK. */
+static uint8_t *cluster_buf;
+
+/* Pages queued in CLUSTER_BUF for swap_out_end() to write, under
+   SWAP_LOCK: page I goes to slot OUT_SLOTS[I].  SPILL_CNT of them
+   were spilled from the compressed cache. */
+static size_t out_slots[OUT_MAX];
+static size_t out_cnt, spill_cnt;
 
 void swap_init()
 {
 	swap_block = block_get_role(BLOCK_SWAP);
+	swap_size = swap_block != NULL ? block_size(swap_block) / SECTORS_PER_SLOT : 0;
 	swap_bitmap = bitmap_create(swap_size);
+	if (swap_bitmap == NULL)
+		PANIC("can't allocate swap bitmap");
 	bitmap_set_all(swap_bitmap, 0);
+	next_slot = 0;
 	lock_init(&swap_lock);
+	cluster_buf = palloc_get_multiple(PAL_ASSERT, OUT_MAX);
+	zswap_init();
+}
+
+/* Marks CNT consecutive free slots used and returns the first,
+   or BITMAP_ERROR if there is no such run.  The search starts at
+   NEXT_SLOT and wraps around once, so that it usually finds free
+   slots right away instead of skipping over the used slots at
+   the start of the area, and so that pages swapped out one after
+   another land next to each other.  Must be called with
+   SWAP_LOCK held. */
+static size_t alloc_slots(size_t cnt)
+{
+	size_t index = bitmap_scan_and_flip(swap_bitmap, next_slot, cnt, false);
+
+	if (index == BITMAP_ERROR && next_slot != 0)
+		index = bitmap_scan_and_flip(swap_bitmap, 0, cnt, false);
+	if (index != BITMAP_ERROR)
+		next_slot = index + cnt < swap_size ? index + cnt : 0;
+	return index;
+}
+
+/* Queues a page for swap_out_end() to write to SLOT and returns
+   the page of CLUSTER_BUF to fill with its contents. */
+static void *queue_out(size_t slot)
+{
+	ASSERT(out_cnt < OUT_MAX);
+	out_slots[out_cnt] = slot;
+	return cluster_buf + out_cnt++ * PGSIZE;
+}
+
+/* Queues a page spilled from the compressed cache for
+   swap_out_end() to write to SLOT, and returns the page to
+   decompress it into, or a null pointer if SWAP_CLUSTER pages
+   are already queued this way.  Must be called between
+   swap_out_begin() and swap_out_end(), so that the write waits
+   until the caller's locks are dropped. */
+void *swap_queue_spill(size_t slot)
+{
+	ASSERT(lock_held_by_current_thread(&swap_lock));
+
+	if (spill_cnt >= SWAP_CLUSTER)
+		return NULL;
+	spill_cnt++;
+	return queue_out(slot);
 }
 
+/* Reads swap slots INDEX onward into the pages in KADDRS for
+   which ON_DISK is true, page I from slot INDEX + I, with one
+   sequential transfer per run of such pages.  Must be called
+   with SWAP_LOCK held. */
+static void read_runs(size_t index, void **kaddrs, const bool *on_disk, size_t cnt)
+{
+	size_t start, end, i;
+
+	for (start = 0; start < cnt; start = end)
+	{
+		uint8_t *buf;
+
+		end = start + 1;
+		if (!on_disk[start])
+			continue;
+		while (end < cnt && on_disk[end])
+			end++;
+
+		/* A single page needs no scattering. */
+		buf = end - start == 1 ? kaddrs[start] : cluster_buf;
+		block_read_multiple(swap_block, SECTORS_PER_SLOT * (index + start),
+			SECTORS_PER_SLOT * (end - start), buf);
+		if (buf == cluster_buf)
+			for (i = start; i < end; i++)
+				memcpy(kaddrs[i], buf + (i - start) * PGSIZE, PGSIZE);
+	}
+}
+
+/* Reads swap slot USED_INDEX into KADDR, from the compressed
+   cache if it is there, and frees the slot. */
 void swap_in(unsigned int used_index, void *kaddr)
 {
-	
-	//struct block* swap_block = block_get_role(BLOCK_SWAP);
+	swap_in_multiple(used_index, &kaddr, 1);
+}
+
+/* Reads the CNT consecutive swap slots starting at USED_INDEX
+   into the pages in KADDRS, and frees the slots.  Slots not in
+   the compressed cache are read with one sequential transfer per
+   run. */
+void swap_in_multiple(unsigned int used_index, void **kaddrs, size_t cnt)
+{
+	bool on_disk[SWAP_CLUSTER];
+	size_t i;
+
 	ASSERT(swap_block != NULL);
 	ASSERT(swap_bitmap != NULL);
-	int i = 0;
+	ASSERT(cnt <= SWAP_CLUSTER);
 
 	lock_acquire(&swap_lock);
-	ASSERT(bitmap_test(swap_bitmap, used_index));
-	//bitmap_set_multiple(swap_bitmap, used_index, 1, false);
-	bitmap_flip(swap_bitmap, used_index);
+	ASSERT(bitmap_all(swap_bitmap, used_index, cnt));
+	bitmap_set_multiple(swap_bitmap, used_index, cnt, false);
 
-
-	for(i = 0; i < 8; i++)
-	{
-		block_read(swap_block, 8 * used_index + i, kaddr + BLOCK_SECTOR_SIZE * i);
-	}
+	for (i = 0; i < cnt; i++)
+		on_disk[i] = !zswap_load(used_index + i, kaddrs[i]);
+	read_runs(used_index, kaddrs, on_disk, cnt);
 
 	lock_release(&swap_lock);
 }
 
-unsigned int swap_out(void *kaddr)
+/* Starts writing the CNT pages in KADDRS to swap, storing the
+   slot given to page I into SLOTS[I], or BITMAP_ERROR if swap is
+   full.  The slots are consecutive if such a run is free.  Every
+   page is compressed into the cache or copied aside before this
+   returns, so the caller may free the pages at once, and the
+   disk writes, including those of pages the cache spills to make
+   room, wait for swap_out_end(), which the caller may call after
+   dropping its own locks.  SWAP_LOCK stays held in between, so
+   nobody can read the slots before they are written. */
+void swap_out_begin(void **kaddrs, size_t cnt, size_t *slots)
 {
-	lock_acquire(&swap_lock);
-	//struct block *swap_block = block_get_role(BLOCK_SWAP);
+	size_t index, i;
+
 	ASSERT(swap_block != NULL);
 	ASSERT(swap_bitmap != NULL);
-	int i = 0;
-	unsigned int index = bitmap_scan_and_flip(swap_bitmap, 0, 1, false);
-	if (index == BITMAP_ERROR)
+	ASSERT(cnt <= SWAP_CLUSTER);
+
+	lock_acquire(&swap_lock);
+	out_cnt = spill_cnt = 0;
+	index = alloc_slots(cnt);
+	for (i = 0; i < cnt; i++)
 	{
-		lock_release(&swap_lock);
-		return index;
+		slots[i] = index != BITMAP_ERROR ? index + i : alloc_slots(1);
+		if (slots[i] != BITMAP_ERROR && !zswap_store(slots[i], kaddrs[i]))
+			memcpy(queue_out(slots[i]), kaddrs[i], PGSIZE);
 	}
+}
+
+/* Writes the pages queued since swap_out_begin() to their slots,
+   with one sequential transfer per run of consecutive slots, and
+   releases SWAP_LOCK. */
+void swap_out_end(void)
+{
+	size_t start, end;
 
-	for(i = 0; i < 8; i++)
+	ASSERT(lock_held_by_current_thread(&swap_lock));
+
+	for (start = 0; start < out_cnt; start = end)
 	{
-		block_write(swap_block, 8 * index + i, kaddr + BLOCK_SECTOR_SIZE * i);
+		end = start + 1;
+		while (end < out_cnt && out_slots[end] == out_slots[end - 1] + 1)
+			end++;
+		block_write_multiple(swap_block, SECTORS_PER_SLOT * out_slots[start],
+			SECTORS_PER_SLOT * (end - start), cluster_buf + start * PGSIZE);
 	}
+	out_cnt = spill_cnt = 0;
+	lock_release(&swap_lock);
+}
 
+/* Reads swap slot USED_INDEX into KADDR, leaving the slot in
+   use, so that a forked process can take a copy of its parent's
+   swapped-out page. */
+void swap_read(unsigned int used_index, void *kaddr)
+{
+	lock_acquire(&swap_lock);
+	ASSERT(bitmap_test(swap_bitmap, used_index));
+	if (!zswap_copy(used_index, kaddr))
+		block_read_multiple(swap_block, SECTORS_PER_SLOT * used_index, SECTORS_PER_SLOT, kaddr);
+	lock_release(&swap_lock);
+}
+
+/* Frees swap slot USED_INDEX without reading it, for a process
+   that exits with the page swapped out. */
+void swap_free(unsigned int used_index)
+{
+	lock_acquire(&swap_lock);
+	ASSERT(bitmap_test(swap_bitmap, used_index));
+	zswap_invalidate(used_index);
+	bitmap_reset(swap_bitmap, used_index);
 	lock_release(&swap_lock);
-	return index;
 }
@@ -7,10 +7,22 @@
 #include "vm/frame.h"
 #include "devices/block.h"
 #include <bitmap.h>
+#include <stddef.h>
+
+/* Most pages written to swap in one transfer. */
+#define SWAP_CLUSTER 8
+
+/* Sectors per swap slot. */
+#define SECTORS_PER_SLOT (PGSIZE / BLOCK_SECTOR_SIZE)
 
 void swap_init(void);
 void swap_in(unsigned int used_index, void *kaddr);
-unsigned int swap_out(void *kaddr);
+void swap_in_multiple(unsigned int used_index, void **kaddrs, size_t cnt);
+void swap_out_begin(void **kaddrs, size_t cnt, size_t *slots);
+void swap_out_end(void);
+void *swap_queue_spill(size_t slot);
+void swap_free(unsigned int used_index);
+void swap_read(unsigned int used_index, void *kaddr);
 
 struct lock swap_lock;
 struct bitmap *swap_bitmap;
@@ -0,0 +1,312 @@
+#include "vm/zswap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <round.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "vm/swap.h"
+
+/* Compressed swap cache.
+
+   Pages on their way to swap are compressed into an arena of
+   kernel memory instead of being written to disk, keyed by the
+   swap slot they were given, so that a working set a little
+   larger than user memory swaps mostly to RAM.  A page is written
+   to its slot on disk ("spilled") only when the arena has no room
+   for a newer page, or when it has gone unused for ZSWAP_MAX_AGE
+   ticks.  Pages that do not compress to ZSWAP_MAX_LEN bytes go to
+   disk directly.  Spilled pages are queued for swap_out_end() to
+   write along with the rest of the cluster being swapped out,
+   after reclaim has dropped LRU_LIST_LOCK.
+
+   The cache is off unless the -zswap option gives it pages.
+
+   Everything here runs under SWAP_LOCK. */
+
+/* Default arena size, in pages: disabled. */
+#define ZSWAP_DEFAULT_PAGES 0
+
+/* The arena is allocated in units of this many bytes. */
+#define ZSWAP_UNIT 64
+
+/* Largest compressed page worth keeping. */
+#define ZSWAP_MAX_LEN (PGSIZE * 3 / 4)
+
+/* Ticks after which a cached page is spilled to disk. */
+#define ZSWAP_MAX_AGE (5 * TIMER_FREQ)
+
+size_t zswap_pages = ZSWAP_DEFAULT_PAGES;
+
+/* A compressed page. */
+struct zswap_entry
+{
+	size_t slot;                /* Swap slot, the hash key. */
+	size_t unit;                /* First arena unit. */
+	size_t len;                 /* Compressed length in bytes. */
+	int64_t stored;             /* Timer tick when stored. */
+	struct hash_elem elem;      /* In ENTRIES. */
+	struct list_elem age_elem;  /* In AGE_LIST. */
+};
+
+static uint8_t *arena;          /* ZSWAP_PAGES pages. */
+static struct bitmap *units;    /* Used arena units. */
+static struct hash entries;     /* Cached pages by slot. */
+static struct list age_list;    /* Cached pages, oldest first. */
+static uint8_t *scratch;        /* One page for compression. */
+
+static size_t lz_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t max);
+static void lz_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_len);
+
+static unsigned entry_hash(const struct hash_elem *e, void *aux UNUSED)
+{
+	return hash_int(hash_entry(e, struct zswap_entry, elem)->slot);
+}
+
+static bool entry_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+	return hash_entry(a, struct zswap_entry, elem)->slot
+		< hash_entry(b, struct zswap_entry, elem)->slot;
+}
+
+void zswap_init(void)
+{
+	if (zswap_pages == 0)
+		return;
+	arena = palloc_get_multiple(0, zswap_pages);
+	scratch = palloc_get_page(0);
+	units = bitmap_create(zswap_pages * PGSIZE / ZSWAP_UNIT);
+	if (arena == NULL || scratch == NULL || units == NULL)
+		PANIC("can't allocate %zu pages for compressed swap", zswap_pages);
+	hash_init(&entries, entry_hash, entry_less, NULL);
+	list_init(&age_list);
+}
+
+/* Returns the entry for SLOT, or a null pointer if none. */
+static struct zswap_entry *find_entry(size_t slot)
+{
+	struct zswap_entry key;
+	struct hash_elem *e;
+
+	key.slot = slot;
+	e = hash_find(&entries, &key.elem);
+	return e != NULL ? hash_entry(e, struct zswap_entry, elem) : NULL;
+}
+
+/* Removes and frees entry Z. */
+static void remove_entry(struct zswap_entry *z)
+{
+	bitmap_set_multiple(units, z->unit, DIV_ROUND_UP(z->len, ZSWAP_UNIT), false);
+	hash_delete(&entries, &z->elem);
+	list_remove(&z->age_elem);
+	free(z);
+}
+
+/* Queues the oldest cached page to be written to its slot on
+   disk and drops it from the cache.  Returns false, doing
+   nothing, if the queue is full.  Leaves SCRATCH alone, so that
+   zswap_store() can make room for a page it has already
+   compressed. */
+static bool spill_oldest(void)
+{
+	struct zswap_entry *z = list_entry(list_front(&age_list), struct zswap_entry, age_elem);
+	void *page = swap_queue_spill(z->slot);
+
+	if (page == NULL)
+		return false;
+	lz_decompress(arena + z->unit * ZSWAP_UNIT, z->len, page, PGSIZE);
+	remove_entry(z);
+	return true;
+}
+
+/* Compresses KADDR into the cache as the contents of SLOT.
+   Returns false, storing nothing, if the page does not compress
+   well, the cache is disabled, or no room can be made for it
+   without spilling more than swap_out_end() can take; the caller
+   must then write it to disk itself.  Must be called from
+   swap_out_begin(). */
+bool zswap_store(size_t slot, const void *kaddr)
+{
+	struct zswap_entry *z;
+	size_t len, cnt, unit;
+	int64_t now = timer_ticks();
+
+	if (arena == NULL)
+		return false;
+	ASSERT(find_entry(slot) == NULL);
+
+	while (!list_empty(&age_list)
+		&& now - list_entry(list_front(&age_list), struct zswap_entry, age_elem)->stored > ZSWAP_MAX_AGE
+		&& spill_oldest())
+		continue;
+
+	len = lz_compress(kaddr, PGSIZE, scratch, ZSWAP_MAX_LEN);
+	if (len == 0)
+		return false;
+	z = malloc(sizeof *z);
+	if (z == NULL)
+		return false;
+
+	cnt = DIV_ROUND_UP(len, ZSWAP_UNIT);
+	while ((unit = bitmap_scan_and_flip(units, 0, cnt, false)) == BITMAP_ERROR)
+	{
+		if (list_empty(&age_list) || !spill_oldest())
+		{
+			free(z);
+			return false;
+		}
+	}
+
+	memcpy(arena + unit * ZSWAP_UNIT, scratch, len);
+	z->slot = slot;
+	z->unit = unit;
+	z->len = len;
+	z->stored = now;
+	hash_insert(&entries, &z->elem);
+	list_push_back(&age_list, &z->age_elem);
+	return true;
+}
+
+/* If SLOT is cached, decompresses it into KADDR, drops it from
+   the cache, and returns true.  Otherwise returns false. */
+bool zswap_load(size_t slot, void *kaddr)
+{
+	struct zswap_entry *z;
+
+	if (arena == NULL || (z = find_entry(slot)) == NULL)
+		return false;
+	lz_decompress(arena + z->unit * ZSWAP_UNIT, z->len, kaddr, PGSIZE);
+	remove_entry(z);
+	return true;
+}
+
+/* Like zswap_load(), but leaves SLOT in the cache. */
+bool zswap_copy(size_t slot, void *kaddr)
+{
+	struct zswap_entry *z;
+
+	if (arena == NULL || (z = find_entry(slot)) == NULL)
+		return false;
+	lz_decompress(arena + z->unit * ZSWAP_UNIT, z->len, kaddr, PGSIZE);
+	return true;
+}
+
+/* Drops SLOT from the cache, if it is there, without writing it
+   to disk. */
+void zswap_invalidate(size_t slot)
+{
+	struct zswap_entry *z;
+
+	if (arena != NULL && (z = find_entry(slot)) != NULL)
+		remove_entry(z);
+}
+
+/* LZ77 compression, in the manner of LZRW1.
+
+   The output is a sequence of groups, each a control byte followed
+   by up to 8 items, one per bit of the control byte from least
+   significant up.  A clear bit is a literal byte.  A set bit is a
+   match, the repetition of LEN bytes from OFFSET bytes back: two
+   bytes holding the low 8 bits of OFFSET, then the high 4 bits of
+   OFFSET and LEN - 3 in 4 bits, where 15 means that a third byte
+   follows with LEN - 18.  Matches are found through a hash table
+   of the last position of each 3-byte sequence. */
+
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 4095
+#define LZ_MAX_MATCH (3 + 15 + 255)
+
+static uint16_t lz_table[1 << LZ_HASH_BITS];
+
+static unsigned lz_hash(const uint8_t *p)
+{
+	return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Compresses the LEN bytes at SRC into DST.  Returns the
+   compressed length, or 0 if it would exceed MAX bytes. */
+static size_t lz_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t max)
+{
+	size_t ip = 0, op = 0;
+
+	memset(lz_table, 0, sizeof lz_table);
+	while (ip < len)
+	{
+		size_t ctrl_pos = op++;
+		uint8_t ctrl = 0;
+		int bit;
+
+		/* Room for the control byte and 8 of the longest items. */
+		if (op + 8 * 3 > max)
+			return 0;
+
+		for (bit = 0; bit < 8 && ip < len; bit++)
+		{
+			if (ip + 3 <= len)
+			{
+				unsigned h = lz_hash(src + ip);
+				size_t cand = lz_table[h];
+
+				lz_table[h] = ip;
+				if (cand < ip && ip - cand <= LZ_MAX_OFFSET
+					&& !memcmp(src + cand, src + ip, 3))
+				{
+					size_t off = ip - cand, n = 3;
+
+					while (n < LZ_MAX_MATCH && ip + n < len && src[cand + n] == src[ip + n])
+						n++;
+					dst[op++] = off & 0xff;
+					if (n - 3 < 15)
+						dst[op++] = (off >> 8) << 4 | (n - 3);
+					else
+					{
+						dst[op++] = (off >> 8) << 4 | 15;
+						dst[op++] = n - 18;
+					}
+					ctrl |= 1 << bit;
+					ip += n;
+					continue;
+				}
+			}
+			dst[op++] = src[ip++];
+		}
+		dst[ctrl_pos] = ctrl;
+	}
+	return op;
+}
+
+/* Decompresses the LEN bytes at SRC, produced by lz_compress(),
+   into the DST_LEN bytes at DST. */
+static void lz_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_len)
+{
+	size_t ip = 0, op = 0;
+
+	while (ip < len)
+	{
+		uint8_t ctrl = src[ip++];
+		int bit;
+
+		for (bit = 0; bit < 8 && ip < len; bit++)
+		{
+			if (ctrl & (1 << bit))
+			{
+				size_t off = src[ip] | (src[ip + 1] >> 4) << 8;
+				size_t n = (src[ip + 1] & 15) + 3;
+
+				ip += 2;
+				if (n == 18)
+					n += src[ip++];
+				ASSERT(off > 0 && off <= op && op + n <= dst_len);
+				for (; n > 0; n--, op++)
+					dst[op] = dst[op - off];
+			}
+			else
+				dst[op++] = src[ip++];
+		}
+	}
+	ASSERT(op == dst_len);
+}
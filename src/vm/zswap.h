@@ -0,0 +1,17 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Pages of kernel memory for compressed swap, set by the -zswap
+   kernel option. */
+extern size_t zswap_pages;
+
+void zswap_init(void);
+bool zswap_store(size_t slot, const void *kaddr);
+bool zswap_load(size_t slot, void *kaddr);
+bool zswap_copy(size_t slot, void *kaddr);
+void zswap_invalidate(size_t slot);
+
+#endif